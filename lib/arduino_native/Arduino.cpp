@@ -0,0 +1,284 @@
+#include "Arduino.h"
+#include "IPAddress.h"
+#include "SPI.h"
+#include "Wire.h"
+#include <chrono>
+#include <thread>
+
+int hostArgc = 0;
+char **hostArgv = NULL;
+TwoWire Wire;
+SPIClass SPI;
+
+static const std::chrono::steady_clock::time_point hostStart = std::chrono::steady_clock::now();
+
+unsigned long millis()
+{
+  using namespace std::chrono;
+  return duration_cast<milliseconds>(steady_clock::now() - hostStart).count();
+}
+
+unsigned long micros()
+{
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now() - hostStart).count();
+}
+
+void delay(unsigned long ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void yield()
+{
+  std::this_thread::yield();
+}
+
+long random(long howbig)
+{
+  return howbig > 0 ? rand() % howbig : 0;
+}
+
+long random(long howsmall, long howbig)
+{
+  return howsmall < howbig ? howsmall + random(howbig - howsmall) : howsmall;
+}
+
+void randomSeed(unsigned long seed)
+{
+  srand(seed);
+}
+
+void pinMode(uint8_t, uint8_t)
+{
+}
+
+void digitalWrite(uint8_t, uint8_t)
+{
+}
+
+int digitalRead(uint8_t)
+{
+  return LOW;
+}
+
+char *dtostrf(double value, signed char width, unsigned char precision, char *buffer)
+{
+  sprintf(buffer, "%*.*f", width, precision, value);
+  return buffer;
+}
+
+char *ultoa(unsigned long value, char *buffer, int radix)
+{
+  char digits[sizeof(value) * 8 + 1];
+  int n = 0;
+  do
+  {
+    int digit = value % radix;
+    digits[n++] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+    value /= radix;
+  } while (value > 0);
+  for (int i = 0; i < n; i++)
+  {
+    buffer[i] = digits[n - 1 - i];
+  }
+  buffer[n] = '\0';
+  return buffer;
+}
+
+char *ltoa(long value, char *buffer, int radix)
+{
+  if (value < 0 && radix == 10)
+  {
+    buffer[0] = '-';
+    ultoa(-(unsigned long)value, buffer + 1, radix);
+    return buffer;
+  }
+  return ultoa((unsigned long)value, buffer, radix);
+}
+
+char *itoa(int value, char *buffer, int radix)
+{
+  return ltoa(value, buffer, radix);
+}
+
+char *utoa(unsigned value, char *buffer, int radix)
+{
+  return ultoa(value, buffer, radix);
+}
+
+const char *hostArg(const char *name)
+{
+  for (int i = 1; i + 1 < hostArgc; i++)
+  {
+    if (strcmp(hostArgv[i], name) == 0)
+    {
+      return hostArgv[i + 1];
+    }
+  }
+  return NULL;
+}
+
+String::String(int value, unsigned char base) : String((long)value, base) {}
+
+String::String(unsigned int value, unsigned char base) : String((unsigned long)value, base) {}
+
+String::String(long value, unsigned char base)
+{
+  char buffer[sizeof(value) * 8 + 2];
+  s = ltoa(value, buffer, base);
+}
+
+String::String(unsigned long value, unsigned char base)
+{
+  char buffer[sizeof(value) * 8 + 1];
+  s = ultoa(value, buffer, base);
+}
+
+String::String(float value, unsigned char decimals) : String((double)value, decimals) {}
+
+String::String(double value, unsigned char decimals)
+{
+  char buffer[64];
+  s = dtostrf(value, 1, decimals, buffer);
+}
+
+String IPAddress::toString() const
+{
+  char buffer[16];
+  snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+  return String(buffer);
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+  while (size-- > 0 && write(*buffer++))
+  {
+    n++;
+  }
+  return n;
+}
+
+size_t Print::write(const char *str)
+{
+  return str != NULL ? write((const uint8_t *)str, strlen(str)) : 0;
+}
+
+size_t Print::print(const char *str)
+{
+  return write(str);
+}
+
+size_t Print::print(const String &s)
+{
+  return write(s.c_str());
+}
+
+size_t Print::print(char c)
+{
+  return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned char value, int base)
+{
+  return printNumber(value, base);
+}
+
+size_t Print::print(int value, int base)
+{
+  return print((long)value, base);
+}
+
+size_t Print::print(unsigned int value, int base)
+{
+  return printNumber(value, base);
+}
+
+size_t Print::print(long value, int base)
+{
+  if (value < 0 && base == 10)
+  {
+    return print('-') + printNumber(-(unsigned long)value, base);
+  }
+  return printNumber(value, base);
+}
+
+size_t Print::print(unsigned long value, int base)
+{
+  return printNumber(value, base);
+}
+
+// like the ESP cores, through dtostrf
+size_t Print::print(double value, int digits)
+{
+  char buffer[64];
+  return write(dtostrf(value, 1, digits, buffer));
+}
+
+size_t Print::println()
+{
+  return write("\r\n");
+}
+
+size_t Print::println(const char *str)
+{
+  return print(str) + println();
+}
+
+size_t Print::println(const String &s)
+{
+  return print(s) + println();
+}
+
+size_t Print::println(int value, int base)
+{
+  return print(value, base) + println();
+}
+
+size_t Print::println(double value, int digits)
+{
+  return print(value, digits) + println();
+}
+
+size_t Print::printNumber(unsigned long value, int base)
+{
+  char buffer[sizeof(value) * 8 + 1];
+  return write(ultoa(value, buffer, base < 2 ? 10 : base));
+}
+
+size_t Stream::readBytes(uint8_t *buffer, size_t length)
+{
+  size_t n = 0;
+  while (n < length && available() > 0)
+  {
+    int c = read();
+    if (c < 0)
+    {
+      break;
+    }
+    buffer[n++] = c;
+  }
+  return n;
+}
+
+// the test runner and the replayer bring their own main()
+#if !defined(PIO_UNIT_TESTING) && !defined(HOST_REPLAY)
+int main(int argc, char **argv)
+{
+  hostArgc = argc;
+  hostArgv = argv;
+  setup();
+  for (;;)
+  {
+    loop();
+    // the boards spend the rest of a pass in the SDK, a busy host would only burn a core
+    delayMicroseconds(100);
+  }
+}
+#endif
@@ -0,0 +1,80 @@
+// Arduino API on a Linux host, as far as the sketch, Adafruit GFX, PubSubClient and
+// HeliOS use it. Time starts at zero with the process like on the board.
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define F(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+// pointers are 64 bit here, the fallback of Adafruit GFX would read only 32
+#define pgm_read_pointer(addr) (*(void *const *)(addr))
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define memcpy_P memcpy
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+enum BitOrder
+{
+  LSBFIRST = 0,
+  MSBFIRST = 1
+};
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+using std::max;
+using std::min;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+char *dtostrf(double value, signed char width, unsigned char precision, char *buffer);
+char *itoa(int value, char *buffer, int radix);
+char *ltoa(long value, char *buffer, int radix);
+char *utoa(unsigned value, char *buffer, int radix);
+char *ultoa(unsigned long value, char *buffer, int radix);
+
+// command line of the host program, empty in the test runner
+extern int hostArgc;
+extern char **hostArgv;
+// value of "--name value" on the command line, NULL if it was not given
+const char *hostArg(const char *name);
+
+#include "WString.h"
+#include "Print.h"
+#include "Stream.h"
+
+void setup();
+void loop();
+
+#endif
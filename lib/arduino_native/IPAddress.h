@@ -0,0 +1,38 @@
+#ifndef IPAddress_h
+#define IPAddress_h
+
+#include <stdint.h>
+#include <string.h>
+#include "WString.h"
+
+// IPv4 address, stored in network byte order like on the boards
+class IPAddress
+{
+public:
+  IPAddress() : address(0) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+  {
+    uint8_t bytes[4] = {a, b, c, d};
+    memcpy(&address, bytes, 4);
+  }
+  IPAddress(uint32_t address) : address(address) {}
+
+  operator uint32_t() const
+  {
+    return address;
+  }
+  uint8_t operator[](int index) const
+  {
+    return ((const uint8_t *)&address)[index];
+  }
+  uint8_t *raw_address()
+  {
+    return (uint8_t *)&address;
+  }
+  String toString() const;
+
+private:
+  uint32_t address;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include "LittleFS.h"
+#include <sys/stat.h>
+#include <unistd.h>
+
+LittleFSClass LittleFS;
+
+int File::read()
+{
+  return f ? fgetc(f.get()) : -1;
+}
+
+int File::read(uint8_t *buffer, size_t size)
+{
+  return f ? fread(buffer, 1, size, f.get()) : -1;
+}
+
+size_t File::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t File::write(const uint8_t *buffer, size_t size)
+{
+  return f ? fwrite(buffer, 1, size, f.get()) : 0;
+}
+
+size_t File::size()
+{
+  struct stat st;
+  if (!f)
+  {
+    return 0;
+  }
+  fflush(f.get());
+  return fstat(fileno(f.get()), &st) == 0 ? st.st_size : 0;
+}
+
+size_t File::position()
+{
+  return f ? ftell(f.get()) : 0;
+}
+
+bool File::seek(size_t position)
+{
+  return f && fseek(f.get(), position, SEEK_SET) == 0;
+}
+
+bool LittleFSClass::begin()
+{
+  if (root.empty())
+  {
+    const char *path = hostArg("--fs");
+    root = path != NULL ? path : "littlefs";
+  }
+  mkdir(root.c_str(), 0755);
+  struct stat st;
+  return stat(root.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// the sketch only opens with "r" and "w", binary on the host
+File LittleFSClass::open(const char *path, const char *mode)
+{
+  std::string hostMode = std::string(mode) + "b";
+  return File(fopen(hostPath(path).c_str(), hostMode.c_str()));
+}
+
+bool LittleFSClass::exists(const char *path)
+{
+  return access(hostPath(path).c_str(), F_OK) == 0;
+}
+
+bool LittleFSClass::remove(const char *path)
+{
+  return ::remove(hostPath(path).c_str()) == 0;
+}
+
+std::string LittleFSClass::hostPath(const char *path)
+{
+  return root + (path[0] == '/' ? "" : "/") + path;
+}
@@ -0,0 +1,63 @@
+// LittleFS of the ESP cores on a host directory, "/state.bin" is <root>/state.bin
+
+#ifndef LittleFS_h
+#define LittleFS_h
+
+#include <memory>
+#include <string>
+#include "Arduino.h"
+
+class File
+{
+public:
+  File() {}
+  File(FILE *file)
+  {
+    if (file != NULL)
+    {
+      f.reset(file, fclose);
+    }
+  }
+
+  int read();
+  int read(uint8_t *buffer, size_t size);
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+  size_t size();
+  size_t position();
+  bool seek(size_t position);
+  void close()
+  {
+    f.reset();
+  }
+  operator bool() const
+  {
+    return f != nullptr;
+  }
+
+private:
+  std::shared_ptr<FILE> f;
+};
+
+class LittleFSClass
+{
+public:
+  // --fs on the command line, otherwise "littlefs" in the working directory
+  bool begin();
+  File open(const char *path, const char *mode);
+  bool exists(const char *path);
+  bool remove(const char *path);
+  // host only, for tests that bring their own files
+  void setRoot(const char *path)
+  {
+    root = path;
+  }
+
+private:
+  std::string root;
+  std::string hostPath(const char *path);
+};
+
+extern LittleFSClass LittleFS;
+
+#endif
@@ -0,0 +1,128 @@
+#include "NativeHeap.h"
+#include <atomic>
+#include <errno.h>
+
+std::atomic<size_t> heapInUse(0);
+std::atomic<size_t> heapPeak(0);
+std::atomic<size_t> heapBlocks(0);
+std::atomic<size_t> heapLimit(0);
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+
+extern "C"
+{
+  void *__libc_malloc(size_t size);
+  void *__libc_calloc(size_t count, size_t size);
+  void *__libc_realloc(void *ptr, size_t size);
+  void *__libc_memalign(size_t alignment, size_t size);
+  void __libc_free(void *ptr);
+}
+
+static void *counted(void *ptr)
+{
+  if (ptr != NULL)
+  {
+    size_t used = heapInUse += malloc_usable_size(ptr);
+    heapBlocks++;
+    size_t peak = heapPeak;
+    while (used > peak && !heapPeak.compare_exchange_weak(peak, used))
+    {
+    }
+  }
+  return ptr;
+}
+
+// as if the heap of the board had run out
+static bool limited(size_t size)
+{
+  size_t limit = heapLimit;
+  if (limit != 0 && heapInUse + size > limit)
+  {
+    errno = ENOMEM;
+    return true;
+  }
+  return false;
+}
+
+static void uncount(void *ptr)
+{
+  if (ptr != NULL)
+  {
+    heapInUse -= malloc_usable_size(ptr);
+    heapBlocks--;
+  }
+}
+
+extern "C"
+{
+  void *malloc(size_t size)
+  {
+    return limited(size) ? NULL : counted(__libc_malloc(size));
+  }
+
+  void *calloc(size_t count, size_t size)
+  {
+    return limited(count * size) ? NULL : counted(__libc_calloc(count, size));
+  }
+
+  void *realloc(void *ptr, size_t size)
+  {
+    if (limited(size))
+    {
+      return NULL;
+    }
+    uncount(ptr);
+    void *moved = __libc_realloc(ptr, size);
+    // a failed realloc keeps the old block
+    return counted(moved != NULL || size == 0 ? moved : ptr);
+  }
+
+  void *memalign(size_t alignment, size_t size)
+  {
+    return limited(size) ? NULL : counted(__libc_memalign(alignment, size));
+  }
+
+  void *aligned_alloc(size_t alignment, size_t size)
+  {
+    return limited(size) ? NULL : counted(__libc_memalign(alignment, size));
+  }
+
+  int posix_memalign(void **ptr, size_t alignment, size_t size)
+  {
+    void *p = limited(size) ? NULL : counted(__libc_memalign(alignment, size));
+    if (p == NULL)
+    {
+      return ENOMEM;
+    }
+    *ptr = p;
+    return 0;
+  }
+
+  void free(void *ptr)
+  {
+    uncount(ptr);
+    __libc_free(ptr);
+  }
+}
+#endif
+
+size_t nativeHeapInUse()
+{
+  return heapInUse;
+}
+
+size_t nativeHeapPeak()
+{
+  return heapPeak;
+}
+
+size_t nativeHeapBlocks()
+{
+  return heapBlocks;
+}
+
+void nativeHeapLimit(size_t bytes)
+{
+  heapLimit = bytes;
+}
@@ -0,0 +1,19 @@
+// Tracking allocator of the host: malloc, calloc, realloc and free of the whole process,
+// and with them new and delete, go through counters. Only with glibc, elsewhere the
+// counters stay at zero.
+
+#ifndef NativeHeap_h
+#define NativeHeap_h
+
+#include <stddef.h>
+
+// bytes currently allocated, as usable sizes
+size_t nativeHeapInUse();
+// highest nativeHeapInUse() so far
+size_t nativeHeapPeak();
+// live allocations
+size_t nativeHeapBlocks();
+// allocations that would take nativeHeapInUse() past bytes fail, 0 lifts the limit
+void nativeHeapLimit(size_t bytes);
+
+#endif
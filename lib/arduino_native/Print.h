@@ -0,0 +1,50 @@
+#ifndef Print_h
+#define Print_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "WString.h"
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  size_t write(const char *str);
+  size_t write(const char *buffer, size_t size)
+  {
+    return write((const uint8_t *)buffer, size);
+  }
+  virtual int availableForWrite()
+  {
+    return 0;
+  }
+  virtual void flush() {}
+
+  size_t print(const char *str);
+  size_t print(const String &s);
+  size_t print(char c);
+  size_t print(unsigned char value, int base = DEC);
+  size_t print(int value, int base = DEC);
+  size_t print(unsigned int value, int base = DEC);
+  size_t print(long value, int base = DEC);
+  size_t print(unsigned long value, int base = DEC);
+  size_t print(double value, int digits = 2);
+
+  size_t println();
+  size_t println(const char *str);
+  size_t println(const String &s);
+  size_t println(int value, int base = DEC);
+  size_t println(double value, int digits = 2);
+
+private:
+  size_t printNumber(unsigned long value, int base);
+};
+
+#endif
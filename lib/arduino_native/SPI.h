@@ -0,0 +1,48 @@
+// SPI without a bus, for Adafruit GFX and BusIO to build
+
+#ifndef SPI_h
+#define SPI_h
+
+#include "Arduino.h"
+
+#define SPI_HAS_TRANSACTION
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x01
+#define SPI_MODE2 0x02
+#define SPI_MODE3 0x03
+
+class SPISettings
+{
+public:
+  SPISettings() {}
+  SPISettings(uint32_t, uint8_t, uint8_t) {}
+};
+
+class SPIClass
+{
+public:
+  void begin() {}
+  void end() {}
+  void beginTransaction(SPISettings) {}
+  void endTransaction() {}
+  void setBitOrder(uint8_t) {}
+  void setDataMode(uint8_t) {}
+  void setClockDivider(uint8_t) {}
+  void setFrequency(uint32_t) {}
+  uint8_t transfer(uint8_t)
+  {
+    return 0;
+  }
+  uint16_t transfer16(uint16_t)
+  {
+    return 0;
+  }
+  void transfer(void *, size_t) {}
+  void write(uint8_t) {}
+  void write16(uint16_t) {}
+  void writeBytes(const uint8_t *, uint32_t) {}
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,23 @@
+// Host defaults: a broker on this machine and the topics of the original display. A
+// Secrets.h in include/ is found first and takes precedence.
+
+#ifndef SECRETS_H
+#define SECRETS_H
+
+#define wifiAP "host"
+#define wifiPassword ""
+#define mqtt_server "localhost"
+#define mqtt_port 1883
+#define MY_TZ "CET-1CEST,M3.5.0,M10.5.0/3"
+#define time_server "pool.ntp.org"
+
+#define topTempIn "home/sz/display/tempin"
+#define topTempOut "home/sz/display/tempout"
+#define topBright "home/sz/display/bright"
+#define topMinimalBright "home/sz/display/minbright"
+#define topLightMeterDeb "home/sz/display/lightdebug"
+#define topCool "home/sz/display/cool"
+#define topHeat "home/sz/display/heat"
+#define topSensor "home/sz/display/sensor"
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef WString_h
+#define WString_h
+
+#include <string>
+
+// the part of the Arduino String the sketch uses, on top of std::string
+class String
+{
+public:
+  String(const char *s = "") : s(s != NULL ? s : "") {}
+  String(const std::string &s) : s(s) {}
+  explicit String(char c) : s(1, c) {}
+  explicit String(int value, unsigned char base = 10);
+  explicit String(unsigned int value, unsigned char base = 10);
+  explicit String(long value, unsigned char base = 10);
+  explicit String(unsigned long value, unsigned char base = 10);
+  explicit String(float value, unsigned char decimals = 2);
+  explicit String(double value, unsigned char decimals = 2);
+
+  const char *c_str() const
+  {
+    return s.c_str();
+  }
+  unsigned int length() const
+  {
+    return s.length();
+  }
+  char operator[](unsigned int index) const
+  {
+    return index < s.length() ? s[index] : 0;
+  }
+  String &operator+=(const String &rhs)
+  {
+    s += rhs.s;
+    return *this;
+  }
+  bool operator==(const String &rhs) const
+  {
+    return s == rhs.s;
+  }
+  bool operator!=(const String &rhs) const
+  {
+    return s != rhs.s;
+  }
+  friend String operator+(const String &lhs, const String &rhs)
+  {
+    return String(lhs.s + rhs.s);
+  }
+
+private:
+  std::string s;
+};
+
+#endif
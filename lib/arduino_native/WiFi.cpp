@@ -0,0 +1,211 @@
+#include "WiFi.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+WiFiClient::Socket::~Socket()
+{
+  if (fd >= 0)
+  {
+    close(fd);
+  }
+}
+
+WiFiClient::WiFiClient(int fd) : socket(new Socket{fd})
+{
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+int WiFiClient::connect(IPAddress ip, uint16_t port)
+{
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    return 0;
+  }
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = (uint32_t)ip;
+  // blocking connect like the cores, the socket turns non-blocking afterwards
+  if (::connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    close(fd);
+    return 0;
+  }
+  *this = WiFiClient(fd);
+  return 1;
+}
+
+int WiFiClient::connect(const char *host, uint16_t port)
+{
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *result;
+  if (getaddrinfo(host, NULL, &hints, &result) != 0)
+  {
+    return 0;
+  }
+  uint32_t address = ((sockaddr_in *)result->ai_addr)->sin_addr.s_addr;
+  freeaddrinfo(result);
+  return connect(IPAddress(address), port);
+}
+
+size_t WiFiClient::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+// short writes like on the boards when the send buffer is full
+size_t WiFiClient::write(const uint8_t *buffer, size_t size)
+{
+  if (!*this)
+  {
+    return 0;
+  }
+  ssize_t n = send(socket->fd, buffer, size, MSG_NOSIGNAL);
+  if (n < 0)
+  {
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+      stop();
+    }
+    return 0;
+  }
+  return n;
+}
+
+int WiFiClient::available()
+{
+  if (!*this)
+  {
+    return 0;
+  }
+  int n = 0;
+  ioctl(socket->fd, FIONREAD, &n);
+  return n;
+}
+
+int WiFiClient::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t *buffer, size_t size)
+{
+  if (!*this)
+  {
+    return -1;
+  }
+  ssize_t n = recv(socket->fd, buffer, size, 0);
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+  {
+    stop();
+    return -1;
+  }
+  return n < 0 ? -1 : n;
+}
+
+int WiFiClient::peek()
+{
+  uint8_t c;
+  if (!*this || recv(socket->fd, &c, 1, MSG_PEEK) != 1)
+  {
+    return -1;
+  }
+  return c;
+}
+
+void WiFiClient::stop()
+{
+  socket.reset();
+}
+
+uint8_t WiFiClient::connected()
+{
+  if (!*this)
+  {
+    return 0;
+  }
+  uint8_t c;
+  ssize_t n = recv(socket->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+  {
+    // the peer closed, what it sent before is still readable
+    return available() > 0;
+  }
+  return 1;
+}
+
+int WiFiClient::availableForWrite()
+{
+  if (!*this)
+  {
+    return 0;
+  }
+  int size = 0;
+  socklen_t length = sizeof(size);
+  int queued = 0;
+  getsockopt(socket->fd, SOL_SOCKET, SO_SNDBUF, &size, &length);
+  ioctl(socket->fd, TIOCOUTQ, &queued);
+  return size > queued ? size - queued : 0;
+}
+
+int WiFiClient::unacknowledged()
+{
+  int queued = 0;
+  if (*this)
+  {
+    ioctl(socket->fd, TIOCOUTQ, &queued);
+  }
+  return queued;
+}
+
+void WiFiServer::begin()
+{
+  fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    return;
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0)
+  {
+    stop();
+    return;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+WiFiClient WiFiServer::available()
+{
+  if (fd < 0)
+  {
+    return WiFiClient();
+  }
+  int client = accept(fd, NULL, NULL);
+  return client >= 0 ? WiFiClient(client) : WiFiClient();
+}
+
+void WiFiServer::stop()
+{
+  if (fd >= 0)
+  {
+    close(fd);
+    fd = -1;
+  }
+}
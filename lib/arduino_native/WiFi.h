@@ -0,0 +1,65 @@
+// TCP client and server of the ESP cores on POSIX sockets. The host is always on the
+// network, the association itself is in hal_native.h.
+
+#ifndef WiFi_h
+#define WiFi_h
+
+#include <memory>
+#include "Arduino.h"
+#include "Client.h"
+#include "IPAddress.h"
+
+// copies share the connection like on the boards, the last one closes it
+class WiFiClient : public Client
+{
+public:
+  WiFiClient() {}
+  // takes over an accepted socket
+  explicit WiFiClient(int fd);
+
+  int connect(IPAddress ip, uint16_t port) override;
+  int connect(const char *host, uint16_t port) override;
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+  int available() override;
+  int read() override;
+  int read(uint8_t *buffer, size_t size) override;
+  int peek() override;
+  void flush() override {}
+  // the kernel sends what is still queued and closes in the background
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override
+  {
+    return socket && socket->fd >= 0;
+  }
+  // free space in the send buffer
+  int availableForWrite() override;
+  // bytes sent but not yet acknowledged by the peer
+  int unacknowledged();
+
+private:
+  struct Socket
+  {
+    int fd;
+    ~Socket();
+  };
+  std::shared_ptr<Socket> socket;
+};
+
+class WiFiServer
+{
+public:
+  WiFiServer(uint16_t port) : port(port) {}
+  void begin();
+  // next pending connection, an empty client if there is none
+  WiFiClient available();
+  void stop();
+
+private:
+  uint16_t port;
+  int fd = -1;
+};
+
+#endif
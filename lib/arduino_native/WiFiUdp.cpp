@@ -0,0 +1,131 @@
+#include "WiFiUdp.h"
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const uint32_t loopback = htonl(INADDR_LOOPBACK);
+
+WiFiUDP::~WiFiUDP()
+{
+  stop();
+}
+
+static int openSocket()
+{
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0)
+  {
+    return -1;
+  }
+  in_addr interface = {loopback};
+  unsigned char loop = 1;
+  setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &interface, sizeof(interface));
+  setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return fd;
+}
+
+// every program on the host that joins the group gets its own copy of each packet
+uint8_t WiFiUDP::beginMulticast(IPAddress group, uint16_t port)
+{
+  stop();
+  fd = openSocket();
+  if (fd < 0)
+  {
+    return 0;
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = (uint32_t)group;
+  ip_mreq membership = {};
+  membership.imr_multiaddr.s_addr = (uint32_t)group;
+  membership.imr_interface.s_addr = loopback;
+  if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 ||
+      setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0)
+  {
+    stop();
+    return 0;
+  }
+  return 1;
+}
+
+void WiFiUDP::stop()
+{
+  if (fd >= 0)
+  {
+    close(fd);
+    fd = -1;
+  }
+  rxLength = rxPosition = 0;
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port)
+{
+  if (fd < 0 && (fd = openSocket()) < 0)
+  {
+    return 0;
+  }
+  destination = ip;
+  destinationPort = port;
+  txLength = 0;
+  return 1;
+}
+
+size_t WiFiUDP::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t WiFiUDP::write(const uint8_t *buffer, size_t size)
+{
+  size = min(size, sizeof(tx) - txLength);
+  memcpy(tx + txLength, buffer, size);
+  txLength += size;
+  return size;
+}
+
+int WiFiUDP::endPacket()
+{
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(destinationPort);
+  addr.sin_addr.s_addr = destination;
+  ssize_t n = sendto(fd, tx, txLength, 0, (sockaddr *)&addr, sizeof(addr));
+  txLength = 0;
+  return n >= 0;
+}
+
+int WiFiUDP::parsePacket()
+{
+  rxLength = rxPosition = 0;
+  if (fd < 0)
+  {
+    return 0;
+  }
+  ssize_t n = recv(fd, rx, sizeof(rx), 0);
+  rxLength = n > 0 ? n : 0;
+  return rxLength;
+}
+
+int WiFiUDP::available()
+{
+  return rxLength - rxPosition;
+}
+
+int WiFiUDP::read()
+{
+  return rxPosition < rxLength ? rx[rxPosition++] : -1;
+}
+
+int WiFiUDP::read(uint8_t *buffer, size_t size)
+{
+  size = min(size, rxLength - rxPosition);
+  memcpy(buffer, rx + rxPosition, size);
+  rxPosition += size;
+  return size;
+}
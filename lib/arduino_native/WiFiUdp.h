@@ -0,0 +1,41 @@
+// UDP of the ESP cores on a POSIX socket, multicast goes over the loopback interface
+// so several host programs on one machine see each other's packets
+
+#ifndef WiFiUdp_h
+#define WiFiUdp_h
+
+#include "Arduino.h"
+#include "IPAddress.h"
+
+#define UDP_PACKET_MAX 1472
+
+class WiFiUDP
+{
+public:
+  ~WiFiUDP();
+  uint8_t beginMulticast(IPAddress group, uint16_t port);
+  void stop();
+
+  int beginPacket(IPAddress ip, uint16_t port);
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+  int endPacket();
+
+  // size of the next packet, 0 if there is none
+  int parsePacket();
+  int available();
+  int read();
+  int read(uint8_t *buffer, size_t size);
+
+private:
+  int fd = -1;
+  uint32_t destination = 0;
+  uint16_t destinationPort = 0;
+  uint8_t tx[UDP_PACKET_MAX];
+  size_t txLength = 0;
+  uint8_t rx[UDP_PACKET_MAX];
+  size_t rxLength = 0;
+  size_t rxPosition = 0;
+};
+
+#endif
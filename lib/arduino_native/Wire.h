@@ -0,0 +1,49 @@
+// I2C without a bus, for Adafruit BusIO to build. Nothing answers on the host.
+
+#ifndef Wire_h
+#define Wire_h
+
+#include "Arduino.h"
+
+class TwoWire : public Stream
+{
+public:
+  void begin() {}
+  void begin(int, int) {}
+  void end() {}
+  void setClock(uint32_t) {}
+  void beginTransmission(uint8_t) {}
+  uint8_t endTransmission(bool = true)
+  {
+    return 2;
+  }
+  uint8_t requestFrom(uint8_t, uint8_t, uint8_t = true)
+  {
+    return 0;
+  }
+  size_t write(uint8_t) override
+  {
+    return 1;
+  }
+  size_t write(const uint8_t *, size_t size) override
+  {
+    return size;
+  }
+  using Print::write;
+  int available() override
+  {
+    return 0;
+  }
+  int read() override
+  {
+    return -1;
+  }
+  int peek() override
+  {
+    return -1;
+  }
+};
+
+extern TwoWire Wire;
+
+#endif
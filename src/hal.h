@@ -0,0 +1,70 @@
+// Hardware abstraction for main.cpp: panel, refresh timer, light sensor, clock, network,
+// file system and the few ESP specifics used for diagnostics. The backend is picked by
+// the board. Clients, servers, UDP sockets and files keep the API of the ESP cores,
+// only their types and how they are obtained come from here.
+//
+// Every backend provides:
+//   HalPanel display             Adafruit_GFX compatible panel
+//   HAL_PANEL_REFRESH            1 if the CPU has to scan the panel from a timer interrupt
+//   HAL_ISR_ATTR                 attribute for code called from the refresh interrupt
+//   halPanelBegin()
+//   halPanelPixel(x, y, rgb565)
+//   halPanelBrightness(level)    0..255, interrupt safe
+//   halPanelScan()               one scan step, only called from the refresh interrupt
+//   halPanelScanUs()             estimated time of one scan step, with HAL_PANEL_REFRESH only
+//   HAL_TIMER_MAX_US             longest refresh interval, with HAL_PANEL_REFRESH only
+//   halPanelDuty(level, us)      share of all time a lit LED is on, scan and brightness included
+//   halPanelBlank(on)            dark panel while the refresh is stopped
+//   halTimerStart(isr, us)       periodic refresh interrupt, false if the panel needs none
+//   halTimerStop()
+//   halRenderBegin(frame, us)    calls frame() every us on a core of its own, false if the
+//                                board has only one and the scheduler has to call it
+//   halLock(), halUnlock()       held by the render core while it draws, recursive
+//   halCycles()                  CPU cycle counter
+//   HAL_CYCLES_PER_US            halCycles() per microsecond
+//   halCpuMhz()
+//   halMicros64()
+//   halTime()                    seconds since the epoch
+//   halWallUs()                  microseconds since the epoch
+//   halSetTime(seconds)
+//   halConfigTime(tz, server)
+//   halOnTimeSync(callback)      called whenever the time was set
+//   HalClient, HalServer, HalUdp  TCP client and server, UDP socket
+//   halWifiBegin(ssid, password, channel, bssid)  station mode, channel 0 scans for the AP
+//   halWifiConnected()
+//   halWifiChannel(), halWifiBssid()  of the associated AP
+//   halWifiIp()                  own address, 0 without a connection
+//   halWifiMac(mac)              6 bytes
+//   halModemSleep(on)            deep modem sleep between beacons, off = the core's default
+//   halMulticastBegin(udp, group, port)   joins the group on the current address
+//   halMulticastPacket(udp, group, port)  starts a packet to the group
+//   halClientWritable(client)    bytes a write to the TCP client takes without blocking
+//   HalFile
+//   halFsBegin()                 mounts, formats a file system that does not mount
+//   halFsOpen(path, mode)        "r" or "w"
+//   halFsRemove(path)
+//   halLightBegin()              false without a sensor
+//   halLightRead()               lux
+//   halLoopStackReset()          starts a new high-water mark below the current depth
+//   halLoopStackUsed()           bytes, high-water mark since the last reset if supported
+//   halFreeHeap()
+//   halMaxFreeBlock()
+//   halHeapFragmentation()       percent
+//
+// The backends define objects and are meant to be included from main.cpp only.
+// HAL_NATIVE selects the host backend of the native environment, see hal_native.h.
+
+#ifndef HAL_H
+#define HAL_H
+
+#if defined(ARDUINO_ARCH_ESP8266)
+#include "hal_esp8266.h"
+#elif defined(ARDUINO_ARCH_ESP32)
+#include "hal_esp32.h"
+#elif defined(HAL_NATIVE)
+#include "hal_native.h"
+#else
+#error "no HAL backend for this board"
+#endif
+
+#endif
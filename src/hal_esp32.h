@@ -0,0 +1,313 @@
+// ESP32 backend: HUB75 panel refreshed by I2S DMA, no CPU time spent on the scan
+
+#ifndef HAL_ESP32_H
+#define HAL_ESP32_H
+
+#include <Wire.h>
+#include <Adafruit_I2CDevice.h>
+#include <AS_BH1750.h>
+#include <ESP32-HUB75-MatrixPanel-I2S-DMA.h>
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <LittleFS.h>
+#include <sys/time.h>
+#include <time.h>
+#include <esp_sntp.h>
+#include <esp_timer.h>
+
+// I2C pins of the light sensor, the panel uses the default pins of the DMA library
+#define LIGHT_SDA 21
+#define LIGHT_SCL 22
+
+#define HAL_PANEL_REFRESH 0
+#define HAL_ISR_ATTR IRAM_ATTR
+#define HAL_CYCLES_PER_US (F_CPU / 1000000L)
+// 1/16 scan
+#define PANEL_ROW_PAIRS 16
+#define RENDER_STACK 8192
+#define RENDER_PRIORITY 2
+
+typedef MatrixPanel_I2S_DMA HalPanel;
+typedef WiFiClient HalClient;
+typedef WiFiServer HalServer;
+typedef WiFiUDP HalUdp;
+typedef File HalFile;
+HalPanel display(HUB75_I2S_CFG(64, 32, 1));
+AS_BH1750 lightMeter;
+void (*halTimeSyncCallback)() = NULL;
+SemaphoreHandle_t halRenderMutex = NULL;
+void (*halRenderFrame)() = NULL;
+uint32_t halRenderPeriodUs = 0;
+// the loop task, for its stack high-water mark from any task
+TaskHandle_t halLoopTask = NULL;
+
+inline void halPanelBegin()
+{
+  display.begin();
+}
+
+inline void halPanelPixel(int16_t x, int16_t y, uint16_t color)
+{
+  display.drawPixel(x, y, color);
+}
+
+inline void halPanelBrightness(uint8_t level)
+{
+  display.setBrightness8(level);
+}
+
+inline void halPanelScan()
+{
+}
+
+// the DMA library modulates the output enable with the brightness, one of the row pairs is lit at a time
+inline float halPanelDuty(uint8_t level, uint32_t)
+{
+  return level / 255.0f / PANEL_ROW_PAIRS;
+}
+
+inline void halPanelBlank(bool on)
+{
+  if (on)
+  {
+    display.setBrightness8(0);
+  }
+}
+
+// the DMA engine refreshes the panel on its own
+inline bool halTimerStart(void (*)(), uint32_t)
+{
+  return false;
+}
+
+inline void halTimerStop()
+{
+}
+
+inline void halLock()
+{
+  if (halRenderMutex != NULL)
+  {
+    xSemaphoreTakeRecursive(halRenderMutex, portMAX_DELAY);
+  }
+}
+
+inline void halUnlock()
+{
+  if (halRenderMutex != NULL)
+  {
+    xSemaphoreGiveRecursive(halRenderMutex);
+  }
+}
+
+// a frame that overruns its period starts the next one right away, missed ones are not repeated
+void halRenderTask(void *)
+{
+  TickType_t wake = xTaskGetTickCount();
+  TickType_t period = pdMS_TO_TICKS(halRenderPeriodUs / 1000);
+  for (;;)
+  {
+    halLock();
+    halRenderFrame();
+    halUnlock();
+    if (xTaskGetTickCount() - wake >= period)
+    {
+      wake = xTaskGetTickCount();
+    }
+    vTaskDelayUntil(&wake, period);
+  }
+}
+
+// rendering moves to the core the loop task does not run on
+inline bool halRenderBegin(void (*frame)(), uint32_t periodUs)
+{
+  halLoopTask = xTaskGetCurrentTaskHandle();
+#if CONFIG_FREERTOS_UNICORE
+  return false;
+#endif
+  halRenderMutex = xSemaphoreCreateRecursiveMutex();
+  if (halRenderMutex == NULL)
+  {
+    return false;
+  }
+  halRenderFrame = frame;
+  halRenderPeriodUs = periodUs;
+  if (xTaskCreatePinnedToCore(halRenderTask, "render", RENDER_STACK, NULL, RENDER_PRIORITY, NULL, 1 - xPortGetCoreID()) != pdPASS)
+  {
+    vSemaphoreDelete(halRenderMutex);
+    halRenderMutex = NULL;
+    return false;
+  }
+  return true;
+}
+
+inline uint32_t HAL_ISR_ATTR halCycles()
+{
+  return ESP.getCycleCount();
+}
+
+inline uint32_t halCpuMhz()
+{
+  return ESP.getCpuFreqMHz();
+}
+
+inline uint64_t halMicros64()
+{
+  return esp_timer_get_time();
+}
+
+inline time_t halTime()
+{
+  return time(nullptr);
+}
+
+inline uint64_t halWallUs()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+inline void halSetTime(time_t seconds)
+{
+  timeval tv = {seconds, 0};
+  settimeofday(&tv, nullptr);
+}
+
+inline void halConfigTime(const char *tz, const char *server)
+{
+  configTzTime(tz, server);
+}
+
+inline void halOnTimeSync(void (*callback)())
+{
+  halTimeSyncCallback = callback;
+  sntp_set_time_sync_notification_cb([](struct timeval *) { halTimeSyncCallback(); });
+}
+
+inline void halWifiBegin(const char *ssid, const char *password, int32_t channel, const uint8_t *bssid)
+{
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+  if (channel > 0)
+  {
+    WiFi.begin(ssid, password, channel, bssid);
+  }
+  else
+  {
+    WiFi.begin(ssid, password);
+  }
+}
+
+inline bool halWifiConnected()
+{
+  return WiFi.status() == WL_CONNECTED;
+}
+
+inline int32_t halWifiChannel()
+{
+  return WiFi.channel();
+}
+
+inline const uint8_t *halWifiBssid()
+{
+  return WiFi.BSSID();
+}
+
+inline uint32_t halWifiIp()
+{
+  return halWifiConnected() ? (uint32_t)WiFi.localIP() : 0;
+}
+
+inline void halWifiMac(uint8_t *mac)
+{
+  WiFi.macAddress(mac);
+}
+
+inline void halModemSleep(bool on)
+{
+  WiFi.setSleep(on ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM);
+}
+
+inline void halMulticastBegin(HalUdp &udp, IPAddress group, uint16_t port)
+{
+  udp.beginMulticast(group, port);
+}
+
+inline bool halMulticastPacket(HalUdp &udp, IPAddress group, uint16_t port)
+{
+  return udp.beginPacket(group, port);
+}
+
+// the client has no free space query, a small write fits into the lwIP send buffer
+inline size_t halClientWritable(HalClient &client)
+{
+  return client.connected() ? 512 : 0;
+}
+
+// lwIP sockets send what is queued after the close
+inline bool halClientAcked(HalClient &client)
+{
+  return true;
+}
+
+// closes the socket without waiting
+inline void halClientClose(HalClient &client)
+{
+  client.stop();
+}
+
+// unlike on the ESP8266 formatting has to be asked for
+inline bool halFsBegin()
+{
+  return LittleFS.begin(true);
+}
+
+inline HalFile halFsOpen(const char *path, const char *mode)
+{
+  return LittleFS.open(path, mode);
+}
+
+inline bool halFsRemove(const char *path)
+{
+  return LittleFS.remove(path);
+}
+
+inline bool halLightBegin()
+{
+  Wire.begin(LIGHT_SDA, LIGHT_SCL);
+  return lightMeter.begin(RESOLUTION_AUTO_HIGH, true);
+}
+
+inline float halLightRead()
+{
+  return lightMeter.readLightLevel();
+}
+
+// FreeRTOS keeps the high-water mark of the loop task itself
+inline void halLoopStackReset()
+{
+}
+
+inline uint32_t halLoopStackUsed()
+{
+  return CONFIG_ARDUINO_LOOP_STACK_SIZE - uxTaskGetStackHighWaterMark(halLoopTask);
+}
+
+inline uint32_t halFreeHeap()
+{
+  return ESP.getFreeHeap();
+}
+
+inline uint32_t halMaxFreeBlock()
+{
+  return ESP.getMaxAllocHeap();
+}
+
+inline uint32_t halHeapFragmentation()
+{
+  uint32_t free = ESP.getFreeHeap();
+  return free > 0 ? 100 - ESP.getMaxAllocHeap() * 100 / free : 0;
+}
+
+#endif
@@ -0,0 +1,299 @@
+// ESP8266 backend: PxMATRIX scanned from timer1, BH1750 on the UART pins
+
+#ifndef HAL_ESP8266_H
+#define HAL_ESP8266_H
+
+#include <Wire.h>
+#include <Adafruit_I2CDevice.h>
+#include <AS_BH1750.h>
+#include <PxMatrix.h>
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+#include <LittleFS.h>
+#include <sys/time.h>
+#include <time.h>
+#include <coredecls.h>
+#include <cont.h>
+#include <lwip/tcp.h>
+
+#define P_LAT 16
+#define P_A 5
+#define P_B 4
+#define P_C 15
+#define P_D 12
+#define P_E 0
+#define P_OE 2
+// This defines the 'on' time of the display is us. The larger this number,
+// the brighter the display. If too large the ESP will crash
+uint8_t display_draw_time = 80; //30-70 is usually fine
+
+#define HAL_PANEL_REFRESH 1
+#define HAL_ISR_ATTR ICACHE_RAM_ATTR
+// timer1 runs from the 80MHz APB clock divided by 16 and counts 23 bits
+#define TIMER1_TICKS_PER_US 5
+#define HAL_TIMER_MAX_US (0x7FFFFF / TIMER1_TICKS_PER_US)
+// 1/16 scan, row pairs lit one after another
+#define PANEL_ROW_PAIRS 16
+// shifting one row pair out, 384 bits at the 20MHz SPI clock, before its 'on' time
+#define PANEL_SHIFT_US 20
+// latch pulse and row select through digitalWrite()
+#define PANEL_LATCH_US 5
+
+#define HAL_CYCLES_PER_US (F_CPU / 1000000L)
+
+typedef PxMATRIX HalPanel;
+typedef WiFiClient HalClient;
+typedef WiFiServer HalServer;
+typedef WiFiUDP HalUdp;
+typedef File HalFile;
+HalPanel display(64, 32, P_LAT, P_OE, P_A, P_B, P_C, P_D, P_E);
+AS_BH1750 lightMeter;
+
+inline void halPanelBegin()
+{
+  display.begin(PANEL_ROW_PAIRS);
+}
+
+inline void halPanelPixel(int16_t x, int16_t y, uint16_t color)
+{
+  display.drawPixelRGB565(x, y, color);
+}
+
+inline void HAL_ISR_ATTR halPanelBrightness(uint8_t level)
+{
+  display.setBrightness(level);
+}
+
+// display() and the SPI writes under it are library code in flash, tools/iram_scan.py
+// moves them into IRAM so the ISR keeps running while the flash is busy
+inline void HAL_ISR_ATTR halPanelScan()
+{
+  display.display(display_draw_time);
+}
+
+// one refresh call before the ISR was measured, display() shows one colour plane of
+// every row pair
+inline uint32_t halPanelScanUs()
+{
+  return PANEL_ROW_PAIRS * (display_draw_time + PANEL_SHIFT_US + PANEL_LATCH_US);
+}
+
+// every refresh call lights each row pair once for the draw time scaled by the
+// brightness, so the scan is already in here
+inline float halPanelDuty(uint8_t level, uint32_t intervalUs)
+{
+  float duty = display_draw_time * level / 255.0f / intervalUs;
+  return duty > 1 ? 1 : duty;
+}
+
+// a row can stay lit when the scan stops in the middle of its on time
+inline void halPanelBlank(bool on)
+{
+  if (on)
+  {
+    digitalWrite(P_OE, HIGH);
+  }
+}
+
+inline bool halTimerStart(void (*isr)(), uint32_t intervalUs)
+{
+  timer1_attachInterrupt(isr);
+  timer1_enable(TIM_DIV16, TIM_EDGE, TIM_LOOP);
+  timer1_write(intervalUs * TIMER1_TICKS_PER_US);
+  return true;
+}
+
+inline void halTimerStop()
+{
+  timer1_disable();
+  timer1_detachInterrupt();
+}
+
+// a single core, the scheduler calls the frame and there is nothing to lock
+inline bool halRenderBegin(void (*)(), uint32_t)
+{
+  return false;
+}
+
+inline void halLock()
+{
+}
+
+inline void halUnlock()
+{
+}
+
+inline uint32_t HAL_ISR_ATTR halCycles()
+{
+  return ESP.getCycleCount();
+}
+
+inline uint32_t halCpuMhz()
+{
+  return ESP.getCpuFreqMHz();
+}
+
+inline uint64_t halMicros64()
+{
+  return micros64();
+}
+
+inline time_t halTime()
+{
+  return time(nullptr);
+}
+
+inline uint64_t halWallUs()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+inline void halSetTime(time_t seconds)
+{
+  timeval tv = {seconds, 0};
+  settimeofday(&tv, nullptr);
+}
+
+inline void halConfigTime(const char *tz, const char *server)
+{
+  configTime(tz, server);
+}
+
+inline void halOnTimeSync(void (*callback)())
+{
+  settimeofday_cb(callback);
+}
+
+inline void halWifiBegin(const char *ssid, const char *password, int32_t channel, const uint8_t *bssid)
+{
+  // the SDK would otherwise write the credentials to flash on every begin
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+  if (channel > 0)
+  {
+    WiFi.begin(ssid, password, channel, bssid);
+  }
+  else
+  {
+    WiFi.begin(ssid, password);
+  }
+}
+
+inline bool halWifiConnected()
+{
+  return WiFi.status() == WL_CONNECTED;
+}
+
+inline int32_t halWifiChannel()
+{
+  return WiFi.channel();
+}
+
+inline const uint8_t *halWifiBssid()
+{
+  return WiFi.BSSID();
+}
+
+inline uint32_t halWifiIp()
+{
+  return halWifiConnected() ? (uint32_t)WiFi.localIP() : 0;
+}
+
+inline void halWifiMac(uint8_t *mac)
+{
+  WiFi.macAddress(mac);
+}
+
+// wakes for every 10th beacon, still well within the MQTT keepalive
+inline void halModemSleep(bool on)
+{
+  WiFi.setSleepMode(WIFI_MODEM_SLEEP, on ? 10 : 0);
+}
+
+inline void halMulticastBegin(HalUdp &udp, IPAddress group, uint16_t port)
+{
+  udp.beginMulticast(WiFi.localIP(), group, port);
+}
+
+inline bool halMulticastPacket(HalUdp &udp, IPAddress group, uint16_t port)
+{
+  return udp.beginPacketMulticast(group, port, WiFi.localIP());
+}
+
+inline size_t halClientWritable(HalClient &client)
+{
+  return client.availableForWrite();
+}
+
+// the send buffer is back to its full size once the peer acknowledged everything
+inline bool halClientAcked(HalClient &client)
+{
+  return client.availableForWrite() >= TCP_SND_BUF;
+}
+
+// stop() flushes first and blocks up to 300 ms for acknowledgements the linger already
+// waited for, with 1 ms it closes right away
+inline void halClientClose(HalClient &client)
+{
+  client.stop(1);
+}
+
+// LittleFS formats a partition it cannot mount
+inline bool halFsBegin()
+{
+  return LittleFS.begin();
+}
+
+inline HalFile halFsOpen(const char *path, const char *mode)
+{
+  return LittleFS.open(path, mode);
+}
+
+inline bool halFsRemove(const char *path)
+{
+  return LittleFS.remove(path);
+}
+
+inline bool halLightBegin()
+{
+  // TX and RX are used as GPIOs for I2C
+  pinMode(1, FUNCTION_3);
+  pinMode(3, FUNCTION_3);
+  Wire.begin(1, 3); //SDA(tx), SCL(rx)
+  return lightMeter.begin(RESOLUTION_AUTO_HIGH, true);
+}
+
+inline float halLightRead()
+{
+  return lightMeter.readLightLevel();
+}
+
+// the free cont stack is repainted, so used is the high-water mark since the reset
+inline void halLoopStackReset()
+{
+  ESP.resetFreeContStack();
+}
+
+inline uint32_t halLoopStackUsed()
+{
+  return CONT_STACKSIZE - ESP.getFreeContStack();
+}
+
+inline uint32_t halFreeHeap()
+{
+  return ESP.getFreeHeap();
+}
+
+inline uint32_t halMaxFreeBlock()
+{
+  return ESP.getMaxFreeBlockSize();
+}
+
+inline uint32_t halHeapFragmentation()
+{
+  return ESP.getHeapFragmentation();
+}
+
+#endif
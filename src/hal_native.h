@@ -0,0 +1,344 @@
+// Native backend for running the display logic on a Linux host: the panel is a frame
+// buffer, the network is the host's, the file system a directory and the light sensor
+// reports halNativeLux. The refresh interrupt is a thread standing in for timer1 of
+// the ESP8266, with that board's scan timing, while the frame buffer always shows what
+// was drawn. The Arduino API underneath comes from lib/arduino_native.
+//
+// The wall clock is virtual. It starts at the host time and halSetTime() only moves
+// this program's view of it, so tests and replays never touch the clock of the host.
+
+#ifndef HAL_NATIVE_H
+#define HAL_NATIVE_H
+
+#include <Adafruit_GFX.h>
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <LittleFS.h>
+#include <NativeHeap.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+
+#define HAL_PANEL_REFRESH 1
+#define HAL_ISR_ATTR
+// halCycles() counts nanoseconds
+#define HAL_CYCLES_PER_US 1000
+// the scan of the ESP8266 backend: 23 bit timer at 5 ticks per us, 1/16 scan, the
+// draw time, shifting a row pair out at the SPI clock and latching it
+#define HAL_TIMER_MAX_US (0x7FFFFF / 5)
+#define PANEL_ROW_PAIRS 16
+#define PANEL_SHIFT_US 20
+#define PANEL_LATCH_US 5
+
+class NativePanel : public Adafruit_GFX
+{
+public:
+  uint16_t pixels[64 * 32];
+  uint8_t brightness = 255;
+  bool blanked = false;
+
+  NativePanel() : Adafruit_GFX(64, 32) {}
+  void drawPixel(int16_t x, int16_t y, uint16_t color) override
+  {
+    if (x >= 0 && x < 64 && y >= 0 && y < 32)
+    {
+      pixels[y * 64 + x] = color;
+    }
+  }
+};
+
+typedef NativePanel HalPanel;
+typedef WiFiClient HalClient;
+typedef WiFiServer HalServer;
+typedef WiFiUDP HalUdp;
+typedef File HalFile;
+
+// timer1, calls the ISR every interval until stopped
+struct NativeTimer
+{
+  std::thread thread;
+  std::atomic<bool> running{false};
+
+  void stop()
+  {
+    running = false;
+    if (thread.joinable())
+    {
+      thread.join();
+    }
+  }
+  ~NativeTimer()
+  {
+    stop();
+  }
+};
+
+HalPanel display;
+uint8_t display_draw_time = 80;
+NativeTimer halTimer;
+// what the light sensor reads, set by the test
+float halNativeLux = 100;
+void (*halTimeSyncCallback)() = NULL;
+// virtual wall clock minus the host's
+int64_t halWallOffsetUs = 0;
+
+inline void halPanelBegin()
+{
+  memset(display.pixels, 0, sizeof(display.pixels));
+}
+
+inline void halPanelPixel(int16_t x, int16_t y, uint16_t color)
+{
+  display.drawPixel(x, y, color);
+}
+
+inline void halPanelBrightness(uint8_t level)
+{
+  display.brightness = level;
+  display.blanked = false;
+}
+
+inline void halPanelScan()
+{
+}
+
+inline uint32_t halPanelScanUs()
+{
+  return PANEL_ROW_PAIRS * (display_draw_time + PANEL_SHIFT_US + PANEL_LATCH_US);
+}
+
+// as on the ESP8266, each refresh call lights every row pair for the draw time
+inline float halPanelDuty(uint8_t level, uint32_t intervalUs)
+{
+  float duty = display_draw_time * level / 255.0f / intervalUs;
+  return duty > 1 ? 1 : duty;
+}
+
+inline void halPanelBlank(bool on)
+{
+  display.blanked = on;
+}
+
+inline bool halTimerStart(void (*isr)(), uint32_t intervalUs)
+{
+  halTimer.stop();
+  halTimer.running = true;
+  halTimer.thread = std::thread([isr, intervalUs]()
+  {
+    auto next = std::chrono::steady_clock::now();
+    while (halTimer.running)
+    {
+      next += std::chrono::microseconds(intervalUs);
+      std::this_thread::sleep_until(next);
+      isr();
+    }
+  });
+  return true;
+}
+
+inline void halTimerStop()
+{
+  halTimer.stop();
+}
+
+// the scheduler calls the frame like on the ESP8266
+inline bool halRenderBegin(void (*)(), uint32_t)
+{
+  return false;
+}
+
+inline void halLock()
+{
+}
+
+inline void halUnlock()
+{
+}
+
+inline uint64_t halMicros64()
+{
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+inline uint32_t halCycles()
+{
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+inline uint32_t halCpuMhz()
+{
+  return 1000;
+}
+
+inline uint64_t halWallUs()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec + halWallOffsetUs;
+}
+
+inline time_t halTime()
+{
+  return halWallUs() / 1000000;
+}
+
+// like settimeofday() on the ESP8266 this counts as a time sync
+inline void halSetTime(time_t seconds)
+{
+  halWallOffsetUs += (int64_t)seconds * 1000000 - (int64_t)halWallUs();
+  if (halTimeSyncCallback != NULL)
+  {
+    halTimeSyncCallback();
+  }
+}
+
+// the host clock is already set, syncing goes back to it and takes the zone
+inline void halConfigTime(const char *tz, const char *)
+{
+  halWallOffsetUs = 0;
+  setenv("TZ", tz, 1);
+  tzset();
+  if (halTimeSyncCallback != NULL)
+  {
+    halTimeSyncCallback();
+  }
+}
+
+inline void halOnTimeSync(void (*callback)())
+{
+  halTimeSyncCallback = callback;
+}
+
+// the host is always on its network
+inline void halWifiBegin(const char *, const char *, int32_t, const uint8_t *)
+{
+}
+
+inline bool halWifiConnected()
+{
+  return true;
+}
+
+inline int32_t halWifiChannel()
+{
+  return 1;
+}
+
+inline const uint8_t *halWifiBssid()
+{
+  static const uint8_t bssid[6] = {0};
+  return bssid;
+}
+
+inline uint32_t halWifiIp()
+{
+  return htonl(INADDR_LOOPBACK);
+}
+
+// locally administered, the process id keeps several programs on one host apart
+inline void halWifiMac(uint8_t *mac)
+{
+  uint32_t pid = getpid();
+  uint8_t host[6] = {0x02, 0x00, (uint8_t)(pid >> 24), (uint8_t)(pid >> 16), (uint8_t)(pid >> 8), (uint8_t)pid};
+  memcpy(mac, host, 6);
+}
+
+inline void halModemSleep(bool)
+{
+}
+
+inline void halMulticastBegin(HalUdp &udp, IPAddress group, uint16_t port)
+{
+  udp.beginMulticast(group, port);
+}
+
+inline bool halMulticastPacket(HalUdp &udp, IPAddress group, uint16_t port)
+{
+  return udp.beginPacket(group, port);
+}
+
+inline size_t halClientWritable(HalClient &client)
+{
+  return client.availableForWrite();
+}
+
+inline bool halClientAcked(HalClient &client)
+{
+  return client.unacknowledged() == 0;
+}
+
+inline void halClientClose(HalClient &client)
+{
+  client.stop();
+}
+
+inline bool halFsBegin()
+{
+  return LittleFS.begin();
+}
+
+inline HalFile halFsOpen(const char *path, const char *mode)
+{
+  return LittleFS.open(path, mode);
+}
+
+inline bool halFsRemove(const char *path)
+{
+  return LittleFS.remove(path);
+}
+
+inline bool halLightBegin()
+{
+  return true;
+}
+
+inline float halLightRead()
+{
+  return halNativeLux;
+}
+
+// The host stack is not painted. Tests set the depth the code runs at and the deepest
+// point it reached, a reset repaints below the current depth like on the ESP8266.
+uint32_t halNativeStackDepth = 0;
+uint32_t halNativeStackMark = 0;
+
+inline void halLoopStackReset()
+{
+  halNativeStackMark = halNativeStackDepth;
+}
+
+inline uint32_t halLoopStackUsed()
+{
+  return std::max(halNativeStackMark, halNativeStackDepth);
+}
+
+// The tracking allocator counts the whole process, the C++ runtime and test data
+// included, what the sketch allocates is the difference between two readings.
+#define NATIVE_HEAP_SIZE (16 * 1024 * 1024)
+
+inline uint32_t halFreeHeap()
+{
+  size_t used = nativeHeapInUse();
+  return used < NATIVE_HEAP_SIZE ? NATIVE_HEAP_SIZE - used : 0;
+}
+
+// blocks come from the host's malloc, fragmentation is not modelled
+inline uint32_t halMaxFreeBlock()
+{
+  return halFreeHeap();
+}
+
+inline uint32_t halHeapFragmentation()
+{
+  return 0;
+}
+
+#endif
@@ -1,425 +1,5560 @@
 #include <HeliOS_Arduino.h>
-#include <Wire.h>
-#include <Adafruit_I2CDevice.h>
-#include <AS_BH1750.h>
-#include <PxMatrix.h>
+#include "hal.h"
 #include <Fonts/FreeSans12pt7b.h>
 #include <Fonts/CustomFont.h>
 #include <Fonts/TomThumb.h>
-#include <Ticker.h>
-#include <ESP8266WiFi.h>
-#include <DNSServer.h>
-#include <WiFiManager.h>
 #include <PubSubClient.h>
 #include <Secrets.h>
 #include <time.h>
-
-Ticker display_ticker;
-
-#define P_LAT 16
-#define P_A 5
-#define P_B 4
-#define P_C 15
-#define P_D 12
-#define P_E 0
-#define P_OE 2
-// This defines the 'on' time of the display is us. The larger this number,
-// the brighter the display. If too large the ESP will crash
-uint8_t display_draw_time = 80; //30-70 is usually fine
+#include <atomic>
+#include <new>
 
 struct tm lt;
 int currentHour = 0;
 int currentMinute = 0;
 
-int minimalBright = 4;
+// brightness without light in 1/16 steps, between two panel levels so the refresh ISR
+// dithers the night face instead of showing it at one coarse level
+int minimalBrightFine = 3 * 16 + 8;
 
 // 0=off, 1=heat, 2=cool
 int heatingMode = 0;
 float tempIn = 0;
 float tempOut = 0;
 
-int clockColon = 1;
-bool forward = true;
+// colon alpha 0..32, animated by a tween
+int clockColon = 0;
+// a loaded layout may move the colon or leave it out (-1)
+int colonX = 29;
+int colonY = 14;
+// the clock page is drawn from a layout received over MQTT instead of renderClockPage
+bool layoutActive = false;
 
-PxMATRIX display(64, 32, P_LAT, P_OE, P_A, P_B, P_C, P_D, P_E);
-WiFiClient wifiClient;
+HalClient wifiClient;
 PubSubClient mqttClient(wifiClient);
 
 bool BH1750Check = false;
-AS_BH1750 lightMeter;
 float currentLight = 0;
 bool lightMeterDebug = false;
 char onScreenDebugBuffer[20];
 int brightness = 0;
+// brightness in 1/16 steps, the refresh ISR spreads the fraction in quarters over planes
+int brightnessFine = 0;
+// the refresh ISR sets the brightness while it runs
+bool ditherEnabled = true;
+bool refreshActive = false;
+// highest brightness the current limiter allows for the visible frame
+int brightnessLimit = 255;
+// panel dark and refresh stopped for the night
+bool nightBlanked = false;
+
+
+constexpr uint16_t rgb565(uint8_t r, uint8_t g, uint8_t b)
+{
+  return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+}
+
+uint16_t colBlack = rgb565(0, 0, 0);
+
+struct Theme
+{
+  uint16_t clock;
+  // inside temperature and other regular text
+  uint16_t text;
+  uint16_t warm;
+  uint16_t cold;
+  uint16_t debug;
+};
+
+constexpr Theme themeDay = {rgb565(255, 100, 0), rgb565(255, 255, 255), rgb565(255, 0, 0), rgb565(30, 144, 255), rgb565(255, 30, 0)};
+constexpr Theme themeNight = {rgb565(255, 30, 0), rgb565(255, 116, 26), rgb565(255, 0, 0), rgb565(138, 138, 193), rgb565(255, 30, 0)};
+
+// Everything the display publishes goes below its own prefix, outside of the
+// topDisplayPrefix wildcard it subscribes to, so none of it comes back. The time sync
+// notice keeps its old topic for the integrations listening to it, it has no route.
+#ifndef topOutPrefix
+#define topOutPrefix "home/sz/display-out/"
+#endif
+#ifndef topTheme
+#define topTheme "home/sz/display/theme"
+#endif
+#ifndef topThemeDefine
+#define topThemeDefine "home/sz/display/themedefine"
+#endif
+
+#define USER_THEMES 4
+#define THEME_NAME_LEN 12
+Theme userThemes[USER_THEMES];
+char userThemeNames[USER_THEMES][THEME_NAME_LEN];
+
+// switching themes only swaps this pointer, no light reading yet means night
+const Theme *theme = &themeNight;
+const Theme *themeTarget = &themeNight;
+// true = day/night theme follows the light sensor
+bool themeAuto = true;
+
+// a theme change walks through these precomputed steps, 8 steps over 2 seconds
+#define THEME_FADE_STEPS 8
+#define THEME_FADE_MS 2000
+Theme themeFade[THEME_FADE_STEPS];
+// -1 = no fade running
+int themeFadeStep = -1;
+
+#ifndef topPage
+#define topPage "home/sz/display/page"
+#endif
+#ifndef topPageRotate
+#define topPageRotate "home/sz/display/pagerotate"
+#endif
+#ifndef topPageTransition
+#define topPageTransition "home/sz/display/pagetransition"
+#endif
+#ifndef topHumOut
+#define topHumOut "home/sz/display/humout"
+#endif
+#ifndef topPower
+#define topPower "home/sz/display/power"
+#endif
+#ifndef topEnergyToday
+#define topEnergyToday "home/sz/display/energytoday"
+#endif
+
+#define PAGE_CLOCK 0
+#define PAGE_WEATHER 1
+#define PAGE_ENERGY 2
+#define PAGE_COUNT 3
 
+#define TRANSITION_SLIDE 0
+#define TRANSITION_FADE 1
+#define TRANSITION_US (320UL * 1000)
+// transition progress, the new page is fully visible at TRANSITION_STEPS
+#define TRANSITION_STEPS 256
 
-int colClockNightGreen = 30;
-uint16_t colClockNight = display.color565(255, colClockNightGreen, 0);
-int colClockGreen = 100;
-uint16_t colClock = display.color565(255, colClockGreen, 0);
+const char *pageNames[PAGE_COUNT] = {"clock", "weather", "energy"};
 
-uint16_t colBlack = display.color565(0, 0, 0);
+float humidityOut = 0;
+// tomorrow's minimum/maximum temperature
+float forecastLow = 0;
+float forecastHigh = 0;
+float powerNow = 0;
+float energyToday = 0;
 
-uint16_t colInsideTemp = display.color565(255, 255, 255);
-uint16_t colInsideTempNight = display.color565(255, 116, 26);
+// every page is rendered once into its own offscreen buffer when its data changes,
+// transitions only shift/blend these buffers
+GFXcanvas16 *pageCanvas[PAGE_COUNT];
+// without the heap for all of them the pages share one canvas that only holds the
+// current page, pages then switch without a transition
+bool canvasShared = false;
+int canvasCount = 0;
+bool pageDirty[PAGE_COUNT] = {true, true, true};
+int currentPage = PAGE_CLOCK;
+int nextPage = PAGE_CLOCK;
+// -1 = not pinned, pages rotate if pageRotateMs > 0
+int pinnedPage = -1;
+unsigned long pageRotateMs = 0;
+unsigned long pageShownAt = 0;
+int transitionType = TRANSITION_SLIDE;
+// -1 = no transition running, otherwise the progress set by the transition tween
+int transitionFrame = -1;
+// the visible frame has to be copied from the current page buffer again
+bool frameDirty = true;
 
-uint16_t colWarm = display.color565(255, 0, 0);
-uint16_t colCold = display.color565(30, 144, 255);
-uint16_t colColdNight = display.color565(138, 138, 193);
+#ifndef topRollDigits
+#define topRollDigits "home/sz/display/rolldigits"
+#endif
+// FreeSans12pt7b digits all advance 13px and reach 16px above the baseline
+#define DIGIT_W 13
+#define DIGIT_H 17
+#define DIGIT_TOP 0
+// 15 frames at the 20ms page task = 300ms per roll
+#define ROLL_FRAMES 15
 
+// left edge of the hour and minute digit cells on the clock page
+const int digitX[4] = {3, 3 + DIGIT_W, 36, 36 + DIGIT_W};
+// 1 bit bitmaps of '0'..'9' side by side, rendered once at boot
+GFXcanvas1 *digitCache;
+int digitStride = 0;
+bool rollDigits = true;
+// -1 = no roll running
+int rollFrame = -1;
+uint8_t rollFrom[4];
+uint8_t rollTo[4];
+// bit i set = digit cell i changed and is rolling
+uint8_t rollMask = 0;
 
-void logT(const char *s)
+
+#ifndef topMemStats
+#define topMemStats topOutPrefix "memstats"
+#endif
+
+// stack high-water marks per context: loop and one slot per HeliOS task id, for the
+// refresh ISR only the depth of the system stack on entry
+#define CTX_LOOP 0
+#define CTX_ISR 1
+#define CTX_TASKS 2
+// CTX_TASKS + SCHED_MAX_TASKS
+#define CTX_COUNT 18
+// task id for tasks that are called directly instead of by the scheduler
+#define TASK_DIRECT -1
+// the system stack used by interrupts ends at the top of DRAM
+#define SYS_STACK_TOP 0x40000000
+const char *ctxNames[CTX_COUNT] = {"loop", "isr_entry_depth"};
+uint32_t stackHighWater[CTX_COUNT];
+uint32_t minFreeHeap = 0xFFFFFFFF;
+bool memDebug = false;
+char memDebugBuffer[32];
+
+struct StackProbe;
+// innermost running probe, probes nest when a task calls another one directly
+StackProbe *stackProbeActive = NULL;
+void stackNote(uint32_t used);
+
+// Measures the cont stack used while a task runs. The free stack below the task is
+// repainted on entry, the mark left there by the loop or an enclosing task is noted for
+// them first, so the repaint loses nothing of theirs.
+struct StackProbe
 {
-  display.clearDisplay();
-  display.setTextColor(colCold);
-  display.setFont(&TomThumb);
-  display.setCursor(0, 10);
-  display.print(s);
-}
+  int ctx;
+  uint32_t peak;
+  StackProbe *outer;
+  StackProbe(xTaskId id) : ctx(id >= 0 ? CTX_TASKS + id : CTX_COUNT), peak(0), outer(stackProbeActive)
+  {
+    stackNote(halLoopStackUsed());
+    halLoopStackReset();
+    stackProbeActive = this;
+  }
+  ~StackProbe()
+  {
+    stackNote(halLoopStackUsed());
+    stackProbeActive = outer;
+    if (ctx < CTX_COUNT && peak > stackHighWater[ctx])
+    {
+      stackHighWater[ctx] = peak;
+    }
+  }
+};
 
-void display_updater()
+// the loop and every running probe contain the stack used at this point
+void stackNote(uint32_t used)
 {
-  display.display(display_draw_time);
+  if (used > stackHighWater[CTX_LOOP])
+  {
+    stackHighWater[CTX_LOOP] = used;
+  }
+  for (StackProbe *p = stackProbeActive; p != NULL; p = p->outer)
+  {
+    if (used > p->peak)
+    {
+      p->peak = used;
+    }
+  }
 }
 
-void display_update_enable(bool is_enable)
+// holds off the render core until the end of the scope
+struct RenderLock
 {
-  if (is_enable)
-    display_ticker.attach(0.004, display_updater);
-  else
-    display_ticker.detach();
-}
+  RenderLock()
+  {
+    halLock();
+  }
+  ~RenderLock()
+  {
+    halUnlock();
+  }
+};
 
-void taskTimeSync(xTaskId id)
+void markPagesDirty()
 {
-  configTime(MY_TZ, time_server);
-  mqttClient.publish("home/sz/display/time", "sync");
+  for (int i = 0; i < PAGE_COUNT; i++)
+  {
+    pageDirty[i] = true;
+  }
 }
 
-void taskColonBlink(xTaskId id)
+// blends two RGB565 colors, alpha 0..32 (0 = a, 32 = b)
+uint16_t blend565(uint16_t a, uint16_t b, uint8_t alpha)
 {
-  int steps = 50;
-  display.setCursor(29, 14);
-  display.setFont(&FreeSans12pt7b);
+  uint32_t bg = (a | ((uint32_t)a << 16)) & 0x07E0F81F;
+  uint32_t fg = (b | ((uint32_t)b << 16)) & 0x07E0F81F;
+  uint32_t result = ((((fg - bg) * alpha) >> 5) + bg) & 0x07E0F81F;
+  return (uint16_t)((result >> 16) | result);
+}
 
-  if (forward)
+const Theme *themeByName(const char *name)
+{
+  if (strcmp(name, "day") == 0)
   {
-    clockColon++;
+    return &themeDay;
   }
-  else
+  if (strcmp(name, "night") == 0)
   {
-    clockColon--;
+    return &themeNight;
   }
+  for (int i = 0; i < USER_THEMES; i++)
+  {
+    if (strcmp(name, userThemeNames[i]) == 0)
+    {
+      return &userThemes[i];
+    }
+  }
+  return NULL;
+}
 
-  if (clockColon > steps)
+// "name,clock,text,warm,cold,debug" with colors as RGB hex, e.g. "blue,0000ff,ffffff,ff0000,1e90ff,0000ff"
+void defineTheme(char *definition)
+{
+  char *name = strtok(definition, ",");
+  if (name == NULL || strlen(name) >= THEME_NAME_LEN)
   {
-    forward = false;
+    return;
   }
 
-  if (clockColon < 2)
+  uint16_t colors[5];
+  for (int i = 0; i < 5; i++)
   {
-    forward = true;
+    char *hex = strtok(NULL, ",");
+    if (hex == NULL)
+    {
+      return;
+    }
+    uint32_t rgb = strtoul(hex, NULL, 16);
+    colors[i] = rgb565(rgb >> 16, rgb >> 8, rgb);
   }
 
-  if (currentLight == 0)
+  // reuse a slot with the same name, otherwise take the first free one
+  int slot = -1;
+  for (int i = 0; i < USER_THEMES && slot < 0; i++)
   {
-    display.setTextColor(display.color565(255 / steps * clockColon, colClockNightGreen / steps * clockColon, 0));
+    if (strcmp(name, userThemeNames[i]) == 0)
+    {
+      slot = i;
+    }
   }
-  else
+  for (int i = 0; i < USER_THEMES && slot < 0; i++)
+  {
+    if (userThemeNames[i][0] == '\0')
+    {
+      slot = i;
+    }
+  }
+  if (slot < 0)
   {
-    display.setTextColor(display.color565(255 / steps * clockColon, colClockGreen / steps * clockColon, 0));
+    return;
   }
 
-  display.print(":");
+  strcpy(userThemeNames[slot], name);
+  userThemes[slot] = {colors[0], colors[1], colors[2], colors[3], colors[4]};
+  if (theme == &userThemes[slot])
+  {
+    markPagesDirty();
+  }
 }
 
-void taskSensor(xTaskId id)
+// every publish goes through here so rate and volume can be reported
+unsigned long publishCount = 0;
+unsigned long publishBytes = 0;
+
+#ifndef topOutbox
+#define topOutbox topOutPrefix "outbox"
+#endif
+#ifndef topOutboxStats
+#define topOutboxStats topOutPrefix "outboxstats"
+#endif
+
+// Publishes made while the broker is unreachable wait here and are sent on
+// topOutbox with their original topic and time once the connection is back.
+// They are not replayed to the original topics: MQTT carries no timestamp, so a
+// burst of old values there would be taken as current readings and recorded at
+// the time of the flush. A history consumer fills its gaps from topOutbox using
+// "ts" (0 if the time was never set) or "age_ms".
+#define OUTBOX_SIZE 32
+// only plain values are kept, stats and JSON are sent again anyway
+#define OUTBOX_PAYLOAD 48
+// per flush, flushes are at least OUTBOX_FLUSH_MS apart
+#define OUTBOX_BATCH 4
+#define OUTBOX_FLUSH_MS 100
+
+struct OutboxEntry
 {
-  if (BH1750Check)
-  {
-    currentLight = lightMeter.readLightLevel();
-    char buff[10];
-    dtostrf(currentLight, 4, 2, buff);
-    mqttClient.publish(topSensor, buff);
+  // topics are string literals
+  const char *topic;
+  unsigned long queuedAt;
+  char payload[OUTBOX_PAYLOAD];
+};
+OutboxEntry outbox[OUTBOX_SIZE];
+// index of the oldest entry
+uint8_t outboxHead = 0;
+uint8_t outboxCount = 0;
+uint32_t outboxQueued = 0;
+uint32_t outboxFlushed = 0;
+// oldest entries overwritten by newer ones
+uint32_t outboxDropped = 0;
+// too long or not a plain value
+uint32_t outboxSkipped = 0;
 
-    int brightness = (int)currentLight;
-    brightness = minimalBright + currentLight * 5;
-    if (brightness > 255)
-    {
-      brightness = 255;
-    }
+void outboxPush(const char *topic, const char *payload)
+{
+  if (strlen(payload) >= OUTBOX_PAYLOAD || strchr(payload, '"') != NULL)
+  {
+    outboxSkipped++;
+    return;
+  }
+  if (outboxCount == OUTBOX_SIZE)
+  {
+    outboxHead = (outboxHead + 1) % OUTBOX_SIZE;
+    outboxCount--;
+    outboxDropped++;
+  }
+  OutboxEntry &entry = outbox[(outboxHead + outboxCount) % OUTBOX_SIZE];
+  entry.topic = topic;
+  entry.queuedAt = millis();
+  strcpy(entry.payload, payload);
+  outboxCount++;
+  outboxQueued++;
+}
 
-    display.setBrightness(brightness);
+bool mqttPublish(const char *topic, const char *payload)
+{
+  if (!mqttClient.connected())
+  {
+    outboxPush(topic, payload);
+    return false;
+  }
+  if (!mqttClient.publish(topic, payload))
+  {
+    outboxPush(topic, payload);
+    return false;
+  }
+  publishCount++;
+  publishBytes += strlen(topic) + strlen(payload);
+  return true;
+}
 
-    memset(onScreenDebugBuffer, 0, sizeof(onScreenDebugBuffer));
-    strcat(onScreenDebugBuffer, "Sen:");
-    strcat(onScreenDebugBuffer, buff);
-    strcat(onScreenDebugBuffer, "lx Bri:");
-    char cstr[3];
-    itoa(brightness, cstr, 10);
-    strcat(onScreenDebugBuffer, cstr);
+// streamed, for payloads larger than the client buffer, counted once it was sent
+bool mqttPublishLarge(const char *topic, const char *payload, int length)
+{
+  if (!mqttClient.connected() || !mqttClient.beginPublish(topic, length, false))
+  {
+    return false;
+  }
+  mqttClient.write((const uint8_t *)payload, length);
+  if (!mqttClient.endPublish())
+  {
+    return false;
   }
+  publishCount++;
+  publishBytes += strlen(topic) + length;
+  return true;
 }
 
-void taskClock(xTaskId id_)
+// consistent copy of the model for readers that must never see half of an update,
+// including the refresh ISR which can interrupt the writer
+struct DisplayModel
 {
-  int yPosMainText = 16;
-  time_t now = time(&now);
-  localtime_r(&now, &lt);
+  float tempIn;
+  float tempOut;
+  float humidityOut;
+  float forecastLow;
+  float forecastHigh;
+  float powerNow;
+  float energyToday;
+  float light;
+  int heatingMode;
+  int brightness;
+  int brightnessFine;
+};
 
-  currentHour = lt.tm_hour;
-  currentMinute = lt.tm_min;
+DisplayModel modelSnapshot;
+// odd while the snapshot is being written
+std::atomic<uint32_t> modelSeq(0);
 
-  uint16_t clockColor = colClock;
-  uint16_t insideTempColor = colInsideTemp;
+void publishModel()
+{
+  uint32_t seq = modelSeq.load(std::memory_order_relaxed);
+  modelSeq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  modelSnapshot = {tempIn, tempOut, humidityOut, forecastLow, forecastHigh, powerNow, energyToday,
+                   currentLight, heatingMode, std::min(brightness, brightnessLimit),
+                   std::min(brightnessFine, brightnessLimit << 4)};
+  modelSeq.store(seq + 2, std::memory_order_release);
+}
 
-  if (currentLight == 0)
+// used while dithering is off, otherwise the refresh ISR sets the brightness from the model
+void applyBrightness()
+{
+  if (nightBlanked || (ditherEnabled && refreshActive))
   {
-    clockColor = colClockNight;
-    insideTempColor = colInsideTempNight;
+    return;
   }
+  halPanelBrightness(std::min(brightness, brightnessLimit));
+}
 
-  display.clearDisplay();
-  display.setTextColor(clockColor);
-  display.setCursor(3, yPosMainText);
-  display.setFont(&FreeSans12pt7b);
-  display.print(currentHour < 10 ? "0" + String(currentHour) : String(currentHour));
-
-  display.setCursor(36, yPosMainText);
-  display.setTextColor(clockColor);
-  display.print(currentMinute < 10 ? "0" + String(currentMinute) : String(currentMinute));
-
-  if (heatingMode > 0)
+// An interrupt that hits the writer cannot wait for it, so this gives up after a few
+// tries and the caller keeps using its previous copy.
+bool HAL_ISR_ATTR readModel(DisplayModel &out)
+{
+  for (int tries = 0; tries < 3; tries++)
   {
-    if (heatingMode == 1)
+    uint32_t seq = modelSeq.load(std::memory_order_acquire);
+    if (seq & 1)
     {
-      display.drawFastHLine(3, 19, 2, clockColor);
-      display.drawFastHLine(2, 20, 4, clockColor);
-      display.drawFastHLine(1, 21, 6, clockColor);
-      display.drawFastHLine(0, 22, 8, clockColor);
+      continue;
     }
-    else if (heatingMode == 2)
+    DisplayModel copy = modelSnapshot;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (modelSeq.load(std::memory_order_relaxed) == seq)
     {
-      uint16_t color = currentLight == 0 ? colColdNight : colCold;
-      display.drawFastHLine(0, 19, 8, color);
-      display.drawFastHLine(1, 20, 6, color);
-      display.drawFastHLine(2, 21, 4, color);
-      display.drawFastHLine(3, 22, 2, color);
+      out = copy;
+      return true;
     }
-    else
+  }
+  return false;
+}
+
+#ifndef topRefresh
+#define topRefresh "home/sz/display/refresh"
+#endif
+#ifndef topRefreshStats
+#define topRefreshStats topOutPrefix "refreshstats"
+#endif
+
+// PxMatrix shows one color bit plane per display() call. The dither pattern advances with
+// every call and shifts by one step per frame of all planes, so every frame has the same
+// number of raised planes and each plane gets raised equally often. At the 4 ms interval
+// a frame takes 16 ms, there is no slower change in brightness than that.
+#define DITHER_PLANES 4
+#define DITHER_STEPS 4
+
+#ifndef topDither
+#define topDither "home/sz/display/dither"
+#endif
+// the refresh may use at most half of the CPU
+#define REFRESH_MAX_LOAD_PERCENT 50
+
+uint32_t refreshIntervalUs = 4000;
+// written by the ISR only
+volatile uint32_t refreshLastCycles = 0;
+volatile uint32_t refreshJitterMaxUs = 0;
+volatile uint32_t refreshJitterSumUs = 0;
+volatile uint32_t refreshCount = 0;
+volatile uint32_t refreshIsrMaxUs = 0;
+volatile uint32_t refreshCalls = 0;
+
+// bit n of ditherMasks[f] says whether the brightness is raised by one in step n, f/4 of the bits are set
+uint8_t ditherMasks[DITHER_STEPS];
+// last consistent model seen by the ISR
+DisplayModel ditherModel;
+volatile uint32_t ditherMaxCycles = 0;
+
+void initDither()
+{
+  for (int f = 0; f < DITHER_STEPS; f++)
+  {
+    // spreads the set bits evenly instead of grouping them
+    uint8_t mask = 0;
+    for (int n = 0; n < DITHER_STEPS; n++)
     {
-      uint16_t color = colBlack;
-      display.drawFastHLine(0, 19, 8, color);
-      display.drawFastHLine(0, 20, 8, color);
-      display.drawFastHLine(0, 21, 8, color);
-      display.drawFastHLine(0, 22, 8, color);
+      if ((n + 1) * f / DITHER_STEPS > n * f / DITHER_STEPS)
+      {
+        mask |= 1 << n;
+      }
     }
+    ditherMasks[f] = mask;
   }
+}
 
-  display.setTextColor(insideTempColor);
-  display.setFont(&Lato_Hairline_9);
-  display.setCursor(0, 32);
-  display.print(tempIn, 1);
-  // "$" is a degree char in my font
-  display.print("$C ");
-  if (tempOut > 23)
+void HAL_ISR_ATTR display_updater()
+{
+  uint32_t start = halCycles();
+
+  if (refreshLastCycles != 0)
   {
-    display.setTextColor(colWarm);
+    uint32_t intervalUs = (start - refreshLastCycles) / HAL_CYCLES_PER_US;
+    uint32_t jitter = intervalUs > refreshIntervalUs ? intervalUs - refreshIntervalUs : refreshIntervalUs - intervalUs;
+    if (jitter > refreshJitterMaxUs)
+    {
+      refreshJitterMaxUs = jitter;
+    }
+    refreshJitterSumUs += jitter;
+    refreshCount++;
   }
-  else if (tempOut < 2)
+  refreshLastCycles = start;
+
+  // entry depth only, display() itself does not recurse
+  uint32_t depth = SYS_STACK_TOP - (uintptr_t)&depth;
+  if (depth > stackHighWater[CTX_ISR])
   {
-    display.setTextColor(currentLight == 0 ? colColdNight : colCold);
+    stackHighWater[CTX_ISR] = depth;
   }
-  else
+  if (ditherEnabled)
   {
-    display.setTextColor(insideTempColor);
+    uint32_t ditherStart = halCycles();
+    readModel(ditherModel);
+    int base = ditherModel.brightnessFine >> 4;
+    int step = (refreshCalls + refreshCalls / DITHER_PLANES) % DITHER_STEPS;
+    int extra = (ditherMasks[(ditherModel.brightnessFine & 15) >> 2] >> step) & 1;
+    halPanelBrightness(base + extra > 255 ? 255 : base + extra);
+    uint32_t ditherCycles = halCycles() - ditherStart;
+    if (ditherCycles > ditherMaxCycles)
+    {
+      ditherMaxCycles = ditherCycles;
+    }
   }
-  display.print(tempOut, 1);
-  display.print("$C");
+  refreshCalls++;
 
-  if (lightMeterDebug)
+  halPanelScan();
+
+  uint32_t duration = (halCycles() - start) / HAL_CYCLES_PER_US;
+  if (duration > refreshIsrMaxUs)
   {
-    display.setTextColor(colClockNight);
-    display.setFont(&TomThumb);
-    display.setCursor(0, 23);
-    display.print(onScreenDebugBuffer);
+    refreshIsrMaxUs = duration;
   }
 }
 
-void mqttMessageReceived(char *topic, byte *payload, unsigned int length)
+// without HAL_PANEL_REFRESH the panel refreshes itself and this stays inactive
+void display_update_enable(bool is_enable)
 {
-  if (strcmp(topic, topTempIn) == 0)
+  if (is_enable)
   {
-    payload[length] = '\0';
-    tempIn = atof((char *)payload);
+    refreshLastCycles = 0;
+    refreshActive = halTimerStart(display_updater, refreshIntervalUs);
   }
-
-  if (strcmp(topic, topTempOut) == 0)
+  else
   {
-    payload[length] = '\0';
-    tempOut = atof((char *)payload);
+    if (refreshActive)
+    {
+      halTimerStop();
+    }
+    refreshActive = false;
   }
+}
+
+#if HAL_PANEL_REFRESH
+// shortest interval the row scan fits into, from the measured ISR time once there is one
+uint32_t refreshMinIntervalUs()
+{
+  uint32_t isrUs = refreshIsrMaxUs > 0 ? refreshIsrMaxUs : halPanelScanUs();
+  return isrUs * 100 / REFRESH_MAX_LOAD_PERCENT;
+}
 
-  // sets brightness of the screen, will be overwritten almost immediately by the sensor values
-  if (strcmp(topic, topBright) == 0)
+bool setRefreshInterval(uint32_t intervalUs)
+{
+  if (intervalUs < refreshMinIntervalUs() || intervalUs > HAL_TIMER_MAX_US)
   {
-    payload[length] = '\0';
-    char *cstring = (char *)payload;
-    int i = atoi(cstring);
-    display.setBrightness(i);
+    return false;
   }
-  
-  // sets minimal brightness of the screen (used if sensor says zero light)
-  if (strcmp(topic, topMinimalBright) == 0)
+  refreshIntervalUs = intervalUs;
+  refreshJitterMaxUs = 0;
+  refreshJitterSumUs = 0;
+  refreshCount = 0;
+  if (refreshActive)
   {
-    payload[length] = '\0';
-    char *cstring = (char *)payload;
-    minimalBright = atoi(cstring);
+    display_update_enable(true);
   }
+  return true;
+}
+#else
+// the panel refreshes itself, there is no interval to set
+uint32_t refreshMinIntervalUs()
+{
+  return 0;
+}
+
+bool setRefreshInterval(uint32_t)
+{
+  return false;
+}
+#endif
+
+void publishRefreshStats()
+{
+  char stats[128];
+  snprintf(stats, sizeof(stats), "{\"interval_us\":%u,\"min_us\":%u,\"isr_max_us\":%u,\"jitter_max_us\":%u,\"jitter_avg_us\":%u,\"dither_max_cycles\":%u}",
+           refreshIntervalUs, refreshMinIntervalUs(), refreshIsrMaxUs, refreshJitterMaxUs,
+           refreshCount > 0 ? refreshJitterSumUs / refreshCount : 0, ditherMaxCycles);
+  mqttPublish(topRefreshStats, stats);
+}
+
+#ifndef topProfile
+#define topProfile "home/sz/display/profile"
+#endif
+#ifndef topProfileStats
+#define topProfileStats topOutPrefix "profilestats"
+#endif
+
+// Draw call profiler, switched on with "1" on topProfile. Calls are counted where the
+// page code calls the Adafruit_GFX drawing functions. Pixels and overdraw (pixels
+// written more than once on the same surface within a frame) are counted by the
+// outermost call that knows its area. Everything is attributed to the widget drawing it.
+#define PROF_PIXEL 0
+#define PROF_HLINE 1
+#define PROF_VLINE 2
+#define PROF_FILLRECT 3
+#define PROF_CLEAR 4
+#define PROF_PRINT 5
+#define PROF_OPS 6
+#define PROF_OTHER 0
+#define PROF_CLOCK 1
+#define PROF_WEATHER 2
+#define PROF_ENERGY 3
+#define PROF_LAYOUT 4
+#define PROF_SPARKLINE 5
+#define PROF_OVERLAY 6
+#define PROF_BLIT 7
+#define PROF_TRANSITION 8
+#define PROF_ROLL 9
+#define PROF_COLON 10
+#define PROF_WIDGETS 11
+
+struct ProfCounter
+{
+  uint32_t calls;
+  uint32_t pixels;
+  uint32_t overdraw;
+};
 
-  // enable/disable light sensor and brightness information on the screen
-  if (strcmp(topic, topLightMeterDeb) == 0)
+const char *profOpNames[PROF_OPS] = {"pixel", "hline", "vline", "fillrect", "clear", "print"};
+const char *profWidgetNames[PROF_WIDGETS] = {"other", "clock", "weather", "energy", "layout", "sparkline",
+                                             "overlay", "blit", "transition", "roll", "colon"};
+bool profiling = false;
+ProfCounter profOps[PROF_OPS];
+ProfCounter profWidgets[PROF_WIDGETS];
+// drawn to the panel: every write, writes that changed the pixel, overdraw
+ProfCounter profPanel;
+uint32_t profFrames = 0;
+uint32_t profFramePixels = 0;
+uint32_t profFrameMax = 0;
+uint8_t profWidget = PROF_OTHER;
+uint8_t profDepth = 0;
+bool profCovered = false;
+// one bit per pixel written in this frame, for the page canvas being rendered and the panel
+uint64_t profCanvasTouched[32];
+uint64_t profPanelTouched[32];
+// writes per pixel over all surfaces since the profiler was switched on, saturating
+uint8_t *profHeat = NULL;
+char profStats[640];
+
+// marks an area as written, the caller does not clip it
+void profPixels(uint64_t *touched, int16_t x, int16_t y, int16_t w, int16_t h)
+{
+  int16_t x1 = std::min<int16_t>(x + w, 64);
+  int16_t y1 = std::min<int16_t>(y + h, 32);
+  for (int16_t py = std::max<int16_t>(y, 0); py < y1; py++)
   {
-    payload[length] = '\0';
-    char *cstring = (char *)payload;
-    if (strcmp(cstring, "1") == 0)
+    for (int16_t px = std::max<int16_t>(x, 0); px < x1; px++)
     {
-      lightMeterDebug = true;
-    } else {
-      lightMeterDebug = false;
+      uint64_t bit = (uint64_t)1 << px;
+      profFramePixels++;
+      profWidgets[profWidget].pixels++;
+      if (touched[py] & bit)
+      {
+        profWidgets[profWidget].overdraw++;
+        if (touched == profPanelTouched)
+        {
+          profPanel.overdraw++;
+        }
+      }
+      touched[py] |= bit;
+      uint8_t &heat = profHeat[py * 64 + px];
+      if (heat < 255)
+      {
+        heat++;
+      }
     }
   }
+}
 
-  // flag for cooling indicator
-  if (strcmp(topic, topCool) == 0)
+// counts the outermost drawing call, the calls it makes itself are part of it
+struct ProfCall
+{
+  // true if this call counts the pixels
+  bool counts;
+  ProfCall(uint8_t op, bool area) : counts(false)
   {
-    payload[length] = '\0';
-    char *cstring = (char *)payload;
-    if (strcmp(cstring, "On") == 0)
+    if (!profiling)
     {
-      heatingMode = 2;
+      return;
     }
-    else
+    if (profDepth++ == 0)
+    {
+      profOps[op].calls++;
+      profWidgets[profWidget].calls++;
+    }
+    if (area && !profCovered)
     {
-      heatingMode = 0;
+      counts = profCovered = true;
     }
   }
-
-  // flag for heating indicator
-  if (strcmp(topic, topHeat) == 0)
+  ~ProfCall()
   {
-    payload[length] = '\0';
-    char *cstring = (char *)payload;
-    if (strcmp(cstring, "1") == 0)
+    if (profiling)
     {
-      heatingMode = 1;
+      profDepth--;
+      profCovered = profCovered && !counts;
     }
-    else
+  }
+  void area(uint8_t op, int16_t x, int16_t y, int16_t w, int16_t h)
+  {
+    if (counts)
     {
-      heatingMode = 0;
+      profOps[op].pixels += w * h;
+      profPixels(profCanvasTouched, x, y, w, h);
     }
   }
-}
+};
 
-void startMqtt()
+// attributes everything drawn in the enclosing block to a widget
+struct ProfScope
 {
-  while (!mqttClient.connected())
+  uint8_t previous;
+  ProfScope(uint8_t widget) : previous(profWidget)
   {
-    String clientId = "iotdisplay-";
-    clientId += String(random(0xffff), HEX);
-    logT("MQTT connecting ...");
-    delay(1000);
-    if (mqttClient.connect(clientId.c_str()))
-    {
-      logT("MQTT connected");
-      delay(1000);
+    profWidget = widget;
+  }
+  ~ProfScope()
+  {
+    profWidget = previous;
+  }
+};
+
+// the page canvases, counting what is drawn on them
+class ProfCanvas final : public GFXcanvas16
+{
+public:
+  ProfCanvas() : GFXcanvas16(64, 32) {}
+  void drawPixel(int16_t x, int16_t y, uint16_t color) override
+  {
+    ProfCall call(PROF_PIXEL, true);
+    call.area(PROF_PIXEL, x, y, 1, 1);
+    GFXcanvas16::drawPixel(x, y, color);
+  }
+  void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color) override
+  {
+    ProfCall call(PROF_HLINE, true);
+    call.area(PROF_HLINE, x, y, w, 1);
+    GFXcanvas16::drawFastHLine(x, y, w, color);
+  }
+  void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color) override
+  {
+    ProfCall call(PROF_VLINE, true);
+    call.area(PROF_VLINE, x, y, 1, h);
+    GFXcanvas16::drawFastVLine(x, y, h, color);
+  }
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) override
+  {
+    ProfCall call(PROF_FILLRECT, true);
+    call.area(PROF_FILLRECT, x, y, w, h);
+    GFXcanvas16::fillRect(x, y, w, h, color);
+  }
+  void fillScreen(uint16_t color) override
+  {
+    ProfCall call(PROF_CLEAR, true);
+    call.area(PROF_CLEAR, 0, 0, 64, 32);
+    GFXcanvas16::fillScreen(color);
+  }
+  // one call per character, the glyph pixels are counted by the calls drawing them
+  size_t write(uint8_t c) override
+  {
+    ProfCall call(PROF_PRINT, false);
+    return GFXcanvas16::write(c);
+  }
+};
 
-      mqttClient.subscribe(topTempOut);
-      mqttClient.subscribe(topTempIn);
-      mqttClient.subscribe(topHeat);
-      mqttClient.subscribe(topCool);
-      mqttClient.subscribe(topBright);
-      mqttClient.subscribe(topMinimalBright);
-      mqttClient.subscribe(topLightMeterDeb);
-      logT("MQTT subscribed");
+// one canvas per page, or a single shared one when the heap is short, or none at all
+void initPageCanvases()
+{
+  ProfCanvas *made[PAGE_COUNT];
+  int count = 0;
+  while (count < PAGE_COUNT)
+  {
+    ProfCanvas *canvas = new (std::nothrow) ProfCanvas();
+    // the canvas is still constructed when its buffer could not be allocated
+    if (canvas != NULL && canvas->getBuffer() == NULL)
+    {
+      delete canvas;
+      canvas = NULL;
     }
-    else
+    if (canvas == NULL)
     {
-      logT("MQTT failed, retrying...");
-      delay(5000);
+      break;
     }
+    made[count++] = canvas;
+  }
+  canvasShared = count < PAGE_COUNT;
+  // a second canvas is of no use without the third, it goes back to the heap
+  while (canvasShared && count > 1)
+  {
+    delete made[--count];
+  }
+  canvasCount = count;
+  for (int i = 0; i < PAGE_COUNT; i++)
+  {
+    pageCanvas[i] = count == 0 ? NULL : made[canvasShared ? 0 : i];
   }
 }
 
-void startWifi(void)
+// the canvas of the page holds that page
+bool pageOnCanvas(int page)
 {
-  WiFi.begin(wifiAP, wifiPassword);
-  logT("Wifi connecting ...");
-  while (WiFi.status() != WL_CONNECTED)
+  return pageCanvas[page] != NULL && (!canvasShared || page == currentPage);
+}
+
+void profPanelPixel(int16_t x, int16_t y, bool changed)
+{
+  profPanel.calls++;
+  profPanel.pixels += changed;
+  profPixels(profPanelTouched, x, y, 1, 1);
+}
+
+// a page render starts a new frame on its canvas
+void profCanvasBegin()
+{
+  memset(profCanvasTouched, 0, sizeof(profCanvasTouched));
+}
+
+// called by the page task, the colon drawn in between belongs to the same frame
+void profFrameBegin()
+{
+  if (!profiling)
+  {
+    return;
+  }
+  if (profFramePixels > profFrameMax)
   {
-    delay(500);
+    profFrameMax = profFramePixels;
   }
-  logT("Wifi connected");
-  WiFi.softAPdisconnect(true);
+  profFramePixels = 0;
+  profFrames++;
+  memset(profPanelTouched, 0, sizeof(profPanelTouched));
 }
 
-void setup()
+void resetProfile()
 {
-  pinMode(1, FUNCTION_3);
-  pinMode(3, FUNCTION_3);
+  memset(profOps, 0, sizeof(profOps));
+  memset(profWidgets, 0, sizeof(profWidgets));
+  memset(&profPanel, 0, sizeof(profPanel));
+  profFrames = 0;
+  profFramePixels = 0;
+  profFrameMax = 0;
+}
 
-  display.begin(16);
-  display_update_enable(true);
-  mqttClient.setServer(mqtt_server, mqtt_port);
-  mqttClient.setCallback(mqttMessageReceived);
-  startWifi();
-  xHeliOSSetup();
-  taskTimeSync(1);
+// "1" resets the counters and the heatmap and starts counting, anything else stops
+void onProfile(char *payload)
+{
+  bool on = strcmp(payload, "1") == 0;
+  if (on && profHeat == NULL)
+  {
+    profHeat = new uint8_t[64 * 32];
+  }
+  if (on)
+  {
+    memset(profHeat, 0, 64 * 32);
+    resetProfile();
+  }
+  profDepth = 0;
+  profCovered = false;
+  profiling = on;
+}
 
-  Wire.begin(1, 3); //SDA(tx), SCL(rx)
-  BH1750Check = lightMeter.begin(RESOLUTION_AUTO_HIGH, true);
-  if (BH1750Check)
+// totals since the last dump, ops as [calls, pixels], panel and widgets as [calls, pixels, overdraw]
+void publishProfileStats()
+{
+  if (!profiling)
   {
-    logT("Sensor connected.");
-    delay(1000);
+    return;
   }
-  else
+  int len = snprintf(profStats, sizeof(profStats), "{\"frames\":%u,\"max_frame_px\":%u,\"panel\":[%u,%u,%u],\"ops\":{",
+                     profFrames, profFrameMax, profPanel.calls, profPanel.pixels, profPanel.overdraw);
+  for (int i = 0; i < PROF_OPS && len < (int)sizeof(profStats); i++)
+  {
+    len += snprintf(profStats + len, sizeof(profStats) - len, "%s\"%s\":[%u,%u]", i ? "," : "", profOpNames[i],
+                    profOps[i].calls, profOps[i].pixels);
+  }
+  for (int i = 0; i < PROF_WIDGETS && len < (int)sizeof(profStats); i++)
+  {
+    len += snprintf(profStats + len, sizeof(profStats) - len, "%s\"%s\":[%u,%u,%u]", i ? "," : "},\"widgets\":{",
+                    profWidgetNames[i], profWidgets[i].calls, profWidgets[i].pixels, profWidgets[i].overdraw);
+  }
+  if (len < (int)sizeof(profStats))
+  {
+    len += snprintf(profStats + len, sizeof(profStats) - len, "}}");
+  }
+  resetProfile();
+  if (len >= (int)sizeof(profStats))
   {
-    logT("Sensor failed.");
-    delay(1000);
+    return;
   }
+  mqttPublishLarge(topProfileStats, profStats, len);
+}
 
-  display.setBrightness(255);
+#ifndef topPowerEstimate
+#define topPowerEstimate topOutPrefix "powerestimate"
+#endif
+#ifndef topPowerBudget
+#define topPowerBudget "home/sz/display/powerbudget"
+#endif
 
-  // two seconds for the time
-  int id = xTaskAdd("TASKCLOCK", &taskClock);
-  xTaskWait(id);
-  xTaskSetTimer(id, 2 * 1000 * 1000);
+// Rough panel model, calibrate POWER_LED_MA against a meter: current of one fully lit
+// LED of one color while it is on, plus what the ESP and the drivers draw anyway. How
+// long it is on, row scan included, is up to halPanelDuty().
+#define POWER_LED_MA 20
+#define POWER_IDLE_MA 180
 
-  // 20 milliseconds for the colon
-  id = xTaskAdd("TASKCOL", &taskColonBlink);
-  xTaskWait(id);
-  xTaskSetTimer(id, 20 * 1000);
+// what was drawn to the panel, gives the old value of an overwritten pixel
+uint16_t panelShadow[64 * 32];
+// channel intensities of the visible frame, 5 bit red and blue, 6 bit green
+uint32_t powerSumR = 0;
+uint32_t powerSumG = 0;
+uint32_t powerSumB = 0;
+uint32_t powerBudgetMa = 2000;
+bool powerLimited = false;
+// the page task may run on the render core, loop() publishes for it
+bool powerReportDue = false;
 
-  // five seconds for the sensor
-  id = xTaskAdd("TASKSENSOR", &taskSensor);
-  xTaskWait(id);
-  xTaskSetTimer(id, 5 * 1000 * 1000);
+// every pixel on the panel goes through here, unchanged pixels are skipped
+void drawPanelPixel(int16_t x, int16_t y, uint16_t color)
+{
+  uint16_t &old = panelShadow[y * 64 + x];
+  if (profiling)
+  {
+    profPanelPixel(x, y, old != color);
+  }
+  if (old == color)
+  {
+    return;
+  }
+  powerSumR += (color >> 11) - (old >> 11);
+  powerSumG += ((color >> 5) & 0x3F) - ((old >> 5) & 0x3F);
+  powerSumB += (color & 0x1F) - (old & 0x1F);
+  old = color;
+  halPanelPixel(x, y, color);
+}
 
-  // four hours for the timesync
-  id = xTaskAdd("TASKTIMESYNC", &taskTimeSync);
-  xTaskWait(id);
-  time_t fourHours = 60 * 60 * 1000 * 1000;
-  xTaskSetTimer(id, fourHours);
+// Adafruit_GFX drawing onto the panel through drawPanelPixel
+class PanelGfx : public Adafruit_GFX
+{
+public:
+  PanelGfx() : Adafruit_GFX(64, 32) {}
+  void drawPixel(int16_t x, int16_t y, uint16_t color) override
+  {
+    if (x >= 0 && x < 64 && y >= 0 && y < 32)
+    {
+      drawPanelPixel(x, y, color);
+    }
+  }
+  size_t write(uint8_t c) override
+  {
+    ProfCall call(PROF_PRINT, false);
+    return Adafruit_GFX::write(c);
+  }
+};
+PanelGfx panelGfx;
+
+// all lit LEDs averaged over the scan, before the brightness duty cycle
+float powerLoadMa()
+{
+  return POWER_LED_MA * (powerSumR / 31.0f + powerSumG / 63.0f + powerSumB / 31.0f);
 }
 
-uint8_t icon_index = 0;
-void loop()
+uint32_t powerEstimateMa()
 {
-  xHeliOSLoop();
-  if (!mqttClient.connected())
+  return POWER_IDLE_MA + powerLoadMa() * halPanelDuty(std::min(brightness, brightnessLimit), refreshIntervalUs);
+}
+
+// the running sums against a full recount of the shadow
+bool powerSumsValid()
+{
+  uint32_t r = 0;
+  uint32_t g = 0;
+  uint32_t b = 0;
+  for (int i = 0; i < 64 * 32; i++)
   {
-    startMqtt();
+    r += panelShadow[i] >> 11;
+    g += (panelShadow[i] >> 5) & 0x3F;
+    b += panelShadow[i] & 0x1F;
   }
-  mqttClient.loop();
+  return r == powerSumR && g == powerSumG && b == powerSumB;
+}
+
+void publishPower()
+{
+  char stats[160];
+  snprintf(stats, sizeof(stats), "{\"ma\":%u,\"budget_ma\":%u,\"limit\":%d,\"brightness\":%d,\"r\":%u,\"g\":%u,\"b\":%u,\"verified\":%d}",
+           powerEstimateMa(), powerBudgetMa, brightnessLimit, brightness, powerSumR, powerSumG, powerSumB, powerSumsValid());
+  mqttPublish(topPowerEstimate, stats);
+}
+
+// highest brightness that keeps the estimate within the budget, O(1) from the sums
+void updatePowerLimit()
+{
+  float perLevel = powerLoadMa() * halPanelDuty(255, refreshIntervalUs) / 255;
+  int limit = 255;
+  if (perLevel > 0)
+  {
+    float available = (float)powerBudgetMa - POWER_IDLE_MA;
+    limit = available / perLevel < 255 ? std::max(1, (int)(available / perLevel)) : 255;
+  }
+  if (limit == brightnessLimit)
+  {
+    return;
+  }
+
+  brightnessLimit = limit;
+  publishModel();
+  applyBrightness();
+  bool limited = brightness > brightnessLimit;
+  if (limited != powerLimited)
+  {
+    powerLimited = limited;
+    powerReportDue = true;
+  }
+}
+
+#ifndef topCapture
+#define topCapture "home/sz/display/capture"
+#endif
+#ifndef topReplay
+#define topReplay "home/sz/display/replay"
+#endif
+#ifndef topReplayStats
+#define topReplayStats topOutPrefix "replaystats"
+#endif
+
+// Trace file layout: one record per input, each starting with
+// type (1 byte) and the milliseconds since the previous record (varint).
+//   TRACE_MQTT:     topic length (1 byte), topic, payload length (varint), payload
+//   TRACE_LUX:      float
+//   TRACE_TIMESYNC: epoch seconds (uint32)
+#define TRACE_FILE "/trace.bin"
+#define TRACE_MAX_SIZE (256 * 1024)
+#define TRACE_MQTT 1
+#define TRACE_LUX 2
+#define TRACE_TIMESYNC 3
+// at most this many records are replayed per task run
+#define REPLAY_BATCH 8
+
+HalFile traceFile;
+bool capturing = false;
+unsigned long traceLastMs = 0;
+
+bool replaying = false;
+float replaySpeed = 1;
+unsigned long replayStartMs = 0;
+// trace time of the pending record
+unsigned long replayTraceMs = 0;
+int replayType = 0;
+unsigned long replayEvents = 0;
+unsigned long replayTotalUs = 0;
+unsigned long replayMaxUs = 0;
+char replayTopic[64];
+byte replayPayload[MQTT_MAX_PACKET_SIZE];
+
+// render cost, reported together with the replay results
+unsigned long renderCount = 0;
+unsigned long renderTotalUs = 0;
+unsigned long renderMaxUs = 0;
+
+void stopCapture()
+{
+  if (capturing)
+  {
+    traceFile.close();
+    capturing = false;
+  }
+}
+
+void startCapture()
+{
+  stopCapture();
+  traceFile = halFsOpen(TRACE_FILE, "w");
+  if (traceFile)
+  {
+    capturing = true;
+    traceLastMs = millis();
+  }
+}
+
+// "1" starts a new capture, anything else stops it
+void onCapture(const byte *payload, unsigned int length)
+{
+  if (length == 1 && payload[0] == '1')
+  {
+    startCapture();
+  }
+  else
+  {
+    stopCapture();
+  }
+}
+
+void traceWriteVarint(uint32_t v)
+{
+  while (v >= 0x80)
+  {
+    traceFile.write((uint8_t)(v | 0x80));
+    v >>= 7;
+  }
+  traceFile.write((uint8_t)v);
+}
+
+bool traceBegin(uint8_t type)
+{
+  if (!capturing)
+  {
+    return false;
+  }
+  if (traceFile.size() > TRACE_MAX_SIZE)
+  {
+    stopCapture();
+    return false;
+  }
+
+  unsigned long now = millis();
+  traceFile.write(type);
+  traceWriteVarint(now - traceLastMs);
+  traceLastMs = now;
+  return true;
+}
+
+void traceMqtt(const char *topic, const byte *payload, unsigned int length)
+{
+  if (!capturing)
+  {
+    return;
+  }
+  if (!traceBegin(TRACE_MQTT))
+  {
+    return;
+  }
+  uint8_t topicLength = min(strlen(topic), sizeof(replayTopic) - 1);
+  traceFile.write(topicLength);
+  traceFile.write((const uint8_t *)topic, topicLength);
+  traceWriteVarint(length);
+  traceFile.write(payload, length);
+}
+
+void traceLux(float lux)
+{
+  if (!capturing)
+  {
+    return;
+  }
+  if (!traceBegin(TRACE_LUX))
+  {
+    return;
+  }
+  traceFile.write((const uint8_t *)&lux, sizeof(lux));
+}
+
+void traceTimeSync()
+{
+  if (!capturing)
+  {
+    return;
+  }
+  if (!traceBegin(TRACE_TIMESYNC))
+  {
+    return;
+  }
+  uint32_t epoch = halTime();
+  traceFile.write((const uint8_t *)&epoch, sizeof(epoch));
+}
+
+#ifndef topBootTime
+#define topBootTime topOutPrefix "boottime"
+#endif
+
+// boot phases, milliseconds since power-on
+#define BOOT_STATE 0
+#define BOOT_FIRST_FRAME 1
+#define BOOT_WIFI 2
+#define BOOT_TIME 3
+#define BOOT_MQTT 4
+#define BOOT_PHASES 5
+const char *bootPhaseNames[BOOT_PHASES] = {"state", "frame", "wifi", "time", "mqtt"};
+unsigned long bootTimes[BOOT_PHASES];
+// free heap once setup() is done
+uint32_t bootFreeHeap = 0;
+bool bootReported = false;
+
+void bootMark(int phase)
+{
+  if (bootTimes[phase] == 0)
+  {
+    bootTimes[phase] = millis();
+  }
+}
+
+// last known values, restored at boot so the face is complete before any network traffic
+#define STATE_FILE "/state.bin"
+#define STATE_MAGIC 0x44535432
+// LittleFS spreads the writes, but there is no need to write more often than that
+#define STATE_SAVE_INTERVAL_MS (10UL * 60 * 1000)
+struct SavedState
+{
+  uint32_t magic;
+  float tempIn;
+  float tempOut;
+  float humidityOut;
+  float forecastLow;
+  float forecastHigh;
+  float powerNow;
+  float energyToday;
+  int heatingMode;
+  int brightness;
+  // last access point, allows connecting without a scan
+  int32_t wifiChannel;
+  uint8_t wifiBssid[6];
+};
+SavedState savedState;
+unsigned long stateSavedAt = 0;
+
+void loadState()
+{
+  HalFile f = halFsOpen(STATE_FILE, "r");
+  if (!f || f.read((uint8_t *)&savedState, sizeof(savedState)) != sizeof(savedState) || savedState.magic != STATE_MAGIC)
+  {
+    memset(&savedState, 0, sizeof(savedState));
+    savedState.brightness = 255;
+  }
+  f.close();
+
+  tempIn = savedState.tempIn;
+  tempOut = savedState.tempOut;
+  humidityOut = savedState.humidityOut;
+  forecastLow = savedState.forecastLow;
+  forecastHigh = savedState.forecastHigh;
+  powerNow = savedState.powerNow;
+  energyToday = savedState.energyToday;
+  heatingMode = savedState.heatingMode;
+  brightness = savedState.brightness;
+  brightnessFine = brightness << 4;
+}
+
+void saveState(bool force)
+{
+  // replayed values are not the display's own
+  if (replaying)
+  {
+    return;
+  }
+
+  SavedState state = savedState;
+  state.magic = STATE_MAGIC;
+  state.tempIn = tempIn;
+  state.tempOut = tempOut;
+  state.humidityOut = humidityOut;
+  state.forecastLow = forecastLow;
+  state.forecastHigh = forecastHigh;
+  state.powerNow = powerNow;
+  state.energyToday = energyToday;
+  state.heatingMode = heatingMode;
+  state.brightness = brightness;
+
+  if (memcmp(&state, &savedState, sizeof(state)) == 0)
+  {
+    return;
+  }
+  if (!force && stateSavedAt != 0 && millis() - stateSavedAt < STATE_SAVE_INTERVAL_MS)
+  {
+    return;
+  }
+
+  HalFile f = halFsOpen(STATE_FILE, "w");
+  if (f)
+  {
+    f.write((const uint8_t *)&state, sizeof(state));
+    f.close();
+    savedState = state;
+    stateSavedAt = millis();
+  }
+}
+
+void taskState(xTaskId id)
+{
+  StackProbe probe(id);
+  saveState(false);
+}
+
+bool timeValid()
+{
+  // anything before 2020 means there was no time sync yet
+  return halTime() > 1577836800;
+}
+
+#ifndef topSparkline
+#define topSparkline "home/sz/display/sparkline"
+#endif
+#ifndef topHistoryStats
+#define topHistoryStats topOutPrefix "historystats"
+#endif
+
+// 24 hours of tempIn/tempOut, one sample per sparkline column
+#define HISTORY_SAMPLES 64
+#define HISTORY_INTERVAL_S (24UL * 60 * 60 / HISTORY_SAMPLES)
+#define HISTORY_FILE "/history.bin"
+#define HISTORY_MAGIC 0x48535431
+// the sparkline replaces the Lato text below the clock
+#define SPARK_TOP 24
+#define SPARK_H 8
+
+// values in 0.1 degrees, each sample is stored as the difference to the previous one
+struct TempSeries
+{
+  // value of the oldest sample
+  int16_t first;
+  // value of the newest sample, deltas are clamped so this is what was actually stored
+  int16_t last;
+  int8_t delta[HISTORY_SAMPLES];
+};
+struct TempHistory
+{
+  uint32_t magic;
+  // HISTORY_INTERVAL_S slot of the newest sample, 0 = empty
+  uint32_t lastSlot;
+  uint8_t head;
+  uint8_t count;
+  TempSeries in;
+  TempSeries out;
+};
+TempHistory history;
+
+bool showSparkline = false;
+// the band of the clock canvas holds a complete sparkline drawn with this theme and scale
+const Theme *sparkTheme = NULL;
+int16_t sparkMin = 0;
+int16_t sparkMax = 0;
+unsigned long sparkFullUs = 0;
+unsigned long sparkShiftUs = 0;
+
+void seriesPush(TempSeries &series, int slot, int16_t value)
+{
+  if (history.count == 0)
+  {
+    series.first = value;
+    series.last = value;
+    series.delta[slot] = 0;
+    return;
+  }
+  int delta = constrain(value - series.last, -127, 127);
+  series.delta[slot] = delta;
+  series.last += delta;
+}
+
+void historyPush(int16_t in, int16_t out)
+{
+  if (history.count == HISTORY_SAMPLES)
+  {
+    // the second oldest sample becomes the first
+    history.head = (history.head + 1) % HISTORY_SAMPLES;
+    history.in.first += history.in.delta[history.head];
+    history.out.first += history.out.delta[history.head];
+    history.count--;
+  }
+  int slot = (history.head + history.count) % HISTORY_SAMPLES;
+  seriesPush(history.in, slot, in);
+  seriesPush(history.out, slot, out);
+  history.count++;
+}
+
+// oldest sample first
+void historyDecode(const TempSeries &series, int16_t *values)
+{
+  int16_t value = series.first;
+  for (int i = 0; i < history.count; i++)
+  {
+    if (i > 0)
+    {
+      value += series.delta[(history.head + i) % HISTORY_SAMPLES];
+    }
+    values[i] = value;
+  }
+}
+
+void loadHistory()
+{
+  HalFile f = halFsOpen(HISTORY_FILE, "r");
+  if (!f || f.read((uint8_t *)&history, sizeof(history)) != sizeof(history) || history.magic != HISTORY_MAGIC ||
+      history.count > HISTORY_SAMPLES || history.head >= HISTORY_SAMPLES)
+  {
+    memset(&history, 0, sizeof(history));
+    history.magic = HISTORY_MAGIC;
+  }
+  f.close();
+}
+
+void saveHistory()
+{
+  HalFile f = halFsOpen(HISTORY_FILE, "w");
+  if (f)
+  {
+    f.write((const uint8_t *)&history, sizeof(history));
+    f.close();
+  }
+}
+
+// whole degrees around both series, so the scale and the band rarely have to be redrawn
+bool sparkScale(const int16_t *in, const int16_t *out)
+{
+  int16_t low = in[0];
+  int16_t high = in[0];
+  for (int i = 0; i < history.count; i++)
+  {
+    low = std::min(low, std::min(in[i], out[i]));
+    high = std::max(high, std::max(in[i], out[i]));
+  }
+  low = low >= 0 ? low / 10 * 10 : -((-low + 9) / 10 * 10);
+  high = high >= 0 ? (high + 9) / 10 * 10 : -(-high / 10 * 10);
+  if (high - low < 10)
+  {
+    high = low + 10;
+  }
+  bool changed = low != sparkMin || high != sparkMax;
+  sparkMin = low;
+  sparkMax = high;
+  return changed;
+}
+
+int sparkY(int16_t value)
+{
+  return SPARK_TOP + SPARK_H - 1 - (value - sparkMin) * (SPARK_H - 1) / (sparkMax - sparkMin);
+}
+
+// one column per sample, a vertical span from the previous sample keeps the line connected
+void drawSparkColumn(Adafruit_GFX &gfx, int x, const int16_t *in, const int16_t *out, int i)
+{
+  gfx.drawFastVLine(x, SPARK_TOP, SPARK_H, colBlack);
+  const int16_t *series[2] = {out, in};
+  uint16_t colors[2] = {theme->cold, theme->warm};
+  for (int s = 0; s < 2; s++)
+  {
+    int y = sparkY(series[s][i]);
+    int prev = i > 0 ? sparkY(series[s][i - 1]) : y;
+    int top = std::min(y, prev);
+    gfx.drawFastVLine(x, top, std::max(y, prev) - top + 1, colors[s]);
+  }
+}
+
+void drawSparkline(Adafruit_GFX &gfx)
+{
+  ProfScope scope(PROF_SPARKLINE);
+  unsigned long start = micros();
+  gfx.fillRect(0, SPARK_TOP, 64, SPARK_H, colBlack);
+  if (history.count > 0)
+  {
+    int16_t in[HISTORY_SAMPLES];
+    int16_t out[HISTORY_SAMPLES];
+    historyDecode(history.in, in);
+    historyDecode(history.out, out);
+    sparkScale(in, out);
+    // the newest sample is in the rightmost column
+    for (int i = 0; i < history.count; i++)
+    {
+      drawSparkColumn(gfx, 64 - history.count + i, in, out, i);
+    }
+  }
+  sparkTheme = theme;
+  sparkFullUs = micros() - start;
+}
+
+// Moves the band of the clock canvas left and draws only the new columns,
+// false if the scale changed and the whole band has to be drawn again.
+bool shiftSparkline(int columns)
+{
+  if (!pageOnCanvas(PAGE_CLOCK))
+  {
+    return false;
+  }
+  unsigned long start = micros();
+  int16_t in[HISTORY_SAMPLES];
+  int16_t out[HISTORY_SAMPLES];
+  historyDecode(history.in, in);
+  historyDecode(history.out, out);
+  if (sparkScale(in, out))
+  {
+    return false;
+  }
+
+  uint16_t *buf = pageCanvas[PAGE_CLOCK]->getBuffer();
+  for (int y = SPARK_TOP; y < SPARK_TOP + SPARK_H; y++)
+  {
+    memmove(buf + y * 64, buf + y * 64 + columns, (64 - columns) * sizeof(uint16_t));
+  }
+  for (int i = history.count - columns; i < history.count; i++)
+  {
+    drawSparkColumn(*pageCanvas[PAGE_CLOCK], 64 - history.count + i, in, out, i);
+  }
+  sparkShiftUs = micros() - start;
+  return true;
+}
+
+void publishHistoryStats()
+{
+  char stats[96];
+  snprintf(stats, sizeof(stats), "{\"samples\":%u,\"bytes\":%u,\"full_us\":%lu,\"shift_us\":%lu}",
+           history.count, (unsigned)sizeof(history), sparkFullUs, sparkShiftUs);
+  mqttPublish(topHistoryStats, stats);
+}
+
+void taskHistory(xTaskId id)
+{
+  StackProbe probe(id);
+  // a replay sets the clock to the recorded time and its values are not live
+  if (!timeValid() || replaying)
+  {
+    return;
+  }
+
+  // a clock that went backwards keeps the stored samples until it catches up again
+  uint32_t slot = halTime() / HISTORY_INTERVAL_S;
+  if (slot <= history.lastSlot)
+  {
+    return;
+  }
+
+  int16_t in = lroundf(tempIn * 10);
+  int16_t out = lroundf(tempOut * 10);
+  uint32_t columns = 1;
+  if (history.lastSlot == 0 || slot - history.lastSlot > HISTORY_SAMPLES)
+  {
+    history.count = 0;
+    history.head = 0;
+    columns = HISTORY_SAMPLES;
+  }
+  else
+  {
+    // slots missed while switched off keep the last stored values
+    columns = slot - history.lastSlot;
+    for (uint32_t i = 1; i < columns; i++)
+    {
+      historyPush(history.in.last, history.out.last);
+    }
+  }
+  historyPush(in, out);
+  history.lastSlot = slot;
+  saveHistory();
+
+  if (!showSparkline || layoutActive)
+  {
+    return;
+  }
+  if (sparkTheme != theme || columns >= HISTORY_SAMPLES || !shiftSparkline(columns))
+  {
+    sparkTheme = NULL;
+  }
+  pageDirty[PAGE_CLOCK] = true;
+}
+
+void timeSynced()
+{
+  bootMark(BOOT_TIME);
+  pageDirty[PAGE_CLOCK] = true;
+  traceTimeSync();
+}
+
+void taskTimeSync(xTaskId id)
+{
+  StackProbe probe(id);
+  halConfigTime(MY_TZ, time_server);
+  mqttPublish("home/sz/display/time", "sync");
+}
+
+// Tweens interpolate a value over a time span instead of over a number of task runs,
+// a late frame skips intermediate values but the animation keeps its speed. All tweens
+// are updated together once per frame by the page task.
+#define TWEEN_POOL 8
+#define TWEEN_NONE -1
+#define EASE_STEPS 32
+#define EASE_LINEAR 0
+#define EASE_IN_OUT 1
+#define EASE_OUT 2
+#define EASE_COUNT 3
+// restarts after every period, with TWEEN_PINGPONG every other period runs backwards
+#define TWEEN_LOOP 1
+#define TWEEN_PINGPONG 2
+#define BRIGHTNESS_RAMP_US (500UL * 1000)
+#define COLON_PERIOD_US (1000UL * 1000)
+
+struct Tween
+{
+  bool active;
+  bool reverse;
+  uint8_t ease;
+  uint8_t flags;
+  // handles of a reused slot differ, a stale handle finds nothing
+  uint8_t generation;
+  int32_t from;
+  int32_t to;
+  int32_t value;
+  uint64_t start;
+  uint32_t durationUs;
+  // gets every new value, may be NULL
+  void (*apply)(int32_t value);
+};
+
+// the time source of the scheduler and the tweens, can be replaced by a virtual clock
+uint64_t (*schedClock)() = halMicros64;
+Tween tweens[TWEEN_POOL];
+uint64_t tweenNow = 0;
+// eased progress 0..256 at EASE_STEPS + 1 points, linear in between
+uint16_t easeTables[EASE_COUNT][EASE_STEPS + 1];
+int brightnessTween = TWEEN_NONE;
+int colonTween = TWEEN_NONE;
+int transitionTween = TWEEN_NONE;
+int themeTween = TWEEN_NONE;
+
+void initEasing()
+{
+  for (int i = 0; i <= EASE_STEPS; i++)
+  {
+    float t = (float)i / EASE_STEPS;
+    easeTables[EASE_LINEAR][i] = lroundf(t * 256);
+    easeTables[EASE_IN_OUT][i] = lroundf(t * t * (3 - 2 * t) * 256);
+    easeTables[EASE_OUT][i] = lroundf((1 - (1 - t) * (1 - t) * (1 - t)) * 256);
+  }
+}
+
+// progress 0..256 in, eased progress 0..256 out
+int32_t ease(uint8_t curve, uint32_t progress)
+{
+  const uint16_t *table = easeTables[curve];
+  uint32_t index = progress * EASE_STEPS / 256;
+  if (index >= EASE_STEPS)
+  {
+    return table[EASE_STEPS];
+  }
+  uint32_t fraction = progress * EASE_STEPS % 256;
+  return table[index] + (((int32_t)table[index + 1] - table[index]) * (int32_t)fraction >> 8);
+}
+
+Tween *tweenFind(int handle)
+{
+  if (handle < 0)
+  {
+    return NULL;
+  }
+  Tween &t = tweens[handle % TWEEN_POOL];
+  return t.active && t.generation == handle / TWEEN_POOL ? &t : NULL;
+}
+
+void tweenStop(int handle)
+{
+  Tween *t = tweenFind(handle);
+  if (t != NULL)
+  {
+    t->active = false;
+  }
+}
+
+// moves a running tween to a new start, the next update picks up the phase from there
+void tweenAlign(int handle, uint64_t start)
+{
+  Tween *t = tweenFind(handle);
+  if (t != NULL)
+  {
+    t->start = start;
+    t->reverse = false;
+  }
+}
+
+// starts at the time of the last update, a full pool jumps straight to the end
+int tweenStart(int32_t from, int32_t to, uint32_t durationUs, uint8_t curve, uint8_t flags, void (*apply)(int32_t))
+{
+  for (int i = 0; i < TWEEN_POOL; i++)
+  {
+    Tween &t = tweens[i];
+    if (t.active)
+    {
+      continue;
+    }
+    uint8_t generation = t.generation + 1;
+    t = {true, false, curve, flags, generation, from, to, from, tweenNow, durationUs, apply};
+    return i + TWEEN_POOL * generation;
+  }
+  if (apply != NULL)
+  {
+    apply(to);
+  }
+  return TWEEN_NONE;
+}
+
+void updateTweens(uint64_t now)
+{
+  tweenNow = now;
+  for (int i = 0; i < TWEEN_POOL; i++)
+  {
+    Tween &t = tweens[i];
+    if (!t.active)
+    {
+      continue;
+    }
+
+    uint64_t elapsed = now - t.start;
+    if (elapsed >= t.durationUs)
+    {
+      if (!(t.flags & TWEEN_LOOP))
+      {
+        t.value = t.to;
+        t.active = false;
+        if (t.apply != NULL)
+        {
+          t.apply(t.value);
+        }
+        continue;
+      }
+      uint64_t periods = elapsed / t.durationUs;
+      t.start += periods * t.durationUs;
+      elapsed -= periods * t.durationUs;
+      if ((t.flags & TWEEN_PINGPONG) && (periods & 1))
+      {
+        t.reverse = !t.reverse;
+      }
+    }
+
+    uint32_t progress = elapsed * 256 / t.durationUs;
+    if (t.reverse)
+    {
+      progress = 256 - progress;
+    }
+    t.value = t.from + (t.to - t.from) * ease(t.ease, progress) / 256;
+    if (t.apply != NULL)
+    {
+      t.apply(t.value);
+    }
+  }
+}
+
+void applyBrightnessFine(int32_t fine)
+{
+  brightnessFine = fine;
+  brightness = fine >> 4;
+  publishModel();
+  applyBrightness();
+}
+
+void rampBrightness(int fine)
+{
+  tweenStop(brightnessTween);
+  brightnessTween = tweenStart(brightnessFine, fine, BRIGHTNESS_RAMP_US, EASE_OUT, 0, applyBrightnessFine);
+}
+
+void startColonTween()
+{
+  colonTween = tweenStart(0, 32, COLON_PERIOD_US, EASE_IN_OUT, TWEEN_LOOP | TWEEN_PINGPONG, [](int32_t alpha) { clockColon = alpha; });
+}
+
+// the theme tween counts the fade steps, THEME_FADE_STEPS ends the fade
+void applyThemeStep(int32_t step)
+{
+  if (step == themeFadeStep)
+  {
+    return;
+  }
+
+  if (step >= THEME_FADE_STEPS)
+  {
+    theme = themeTarget;
+    themeFadeStep = -1;
+  }
+  else
+  {
+    theme = &themeFade[step];
+    themeFadeStep = step;
+  }
+  markPagesDirty();
+}
+
+void setTheme(const Theme *target)
+{
+  if (target == themeTarget)
+  {
+    return;
+  }
+
+  // copy first, the current theme may be one of the fade steps
+  Theme from = *theme;
+  for (int i = 0; i < THEME_FADE_STEPS; i++)
+  {
+    uint8_t alpha = (i + 1) * 32 / (THEME_FADE_STEPS + 1);
+    themeFade[i].clock = blend565(from.clock, target->clock, alpha);
+    themeFade[i].text = blend565(from.text, target->text, alpha);
+    themeFade[i].warm = blend565(from.warm, target->warm, alpha);
+    themeFade[i].cold = blend565(from.cold, target->cold, alpha);
+    themeFade[i].debug = blend565(from.debug, target->debug, alpha);
+  }
+
+  themeTarget = target;
+  themeFadeStep = -1;
+  tweenStop(themeTween);
+  applyThemeStep(0);
+  themeTween = tweenStart(0, THEME_FADE_STEPS, THEME_FADE_MS * 1000UL, EASE_LINEAR, 0, applyThemeStep);
+}
+
+#ifndef topSyncStats
+#define topSyncStats topOutPrefix "syncstats"
+#endif
+
+// Displays in one network share a time reference for the colon animation and the
+// minute change. The display with the lowest id that has the time multicasts its
+// wall clock, the others follow it. A display on its own uses its wall clock.
+#define BEACON_PORT 4299
+#define BEACON_VERSION 1
+#define BEACON_INTERVAL_MS 2000
+// a leader that was not heard for this long is replaced
+#define BEACON_TIMEOUT_MS (3 * BEACON_INTERVAL_MS)
+// queueing only ever delays a beacon, so the largest offset of the last few is used
+#define BEACON_WINDOW 8
+// packets read per loop pass
+#define BEACON_READ_MAX 4
+
+struct BeaconPacket
+{
+  char magic[2];
+  uint8_t version;
+  uint8_t reserved;
+  uint32_t id;
+  // reference time in us since the epoch
+  uint64_t refUs;
+};
+
+IPAddress beaconGroup(239, 255, 42, 99);
+HalUdp beaconUdp;
+// address the group was joined from, changes with a new DHCP lease
+uint32_t beaconIp = 0;
+// last four bytes of the MAC
+uint32_t syncId = 0;
+uint32_t syncLeader = 0;
+unsigned long syncLeaderSeen = 0;
+bool syncValid = false;
+// reference time minus schedClock()
+int64_t syncOffsetUs = 0;
+int64_t beaconOffsets[BEACON_WINDOW];
+uint8_t beaconOffsetCount = 0;
+uint8_t beaconOffsetNext = 0;
+uint32_t beaconsSent = 0;
+uint32_t beaconsReceived = 0;
+uint32_t syncLeaderChanges = 0;
+// largest correction of the offset since the last stats
+uint32_t syncStepMaxUs = 0;
+
+uint64_t syncNowUs()
+{
+  return schedClock() + syncOffsetUs;
+}
+
+time_t syncTime()
+{
+  return syncValid ? syncNowUs() / 1000000 : halTime();
+}
+
+// the colon is fully visible at odd seconds of the reference on every display
+void alignColon()
+{
+  uint64_t now = schedClock();
+  tweenAlign(colonTween, now - (now + syncOffsetUs) % (2 * COLON_PERIOD_US));
+}
+
+void setSyncOffset(int64_t offset)
+{
+  if (syncValid)
+  {
+    uint32_t step = llabs(offset - syncOffsetUs);
+    if (step > syncStepMaxUs)
+    {
+      syncStepMaxUs = step;
+    }
+  }
+  syncOffsetUs = offset;
+  syncValid = true;
+  alignColon();
+}
+
+bool syncLeading()
+{
+  return syncLeader == syncId;
+}
+
+// a leader without the time does not send, anyone who does is followed
+bool syncLeaderLost()
+{
+  return syncLeading() ? !timeValid() : millis() - syncLeaderSeen > BEACON_TIMEOUT_MS;
+}
+
+void followLeader(uint32_t id)
+{
+  if (id != syncLeader)
+  {
+    syncLeader = id;
+    syncLeaderChanges++;
+    beaconOffsetCount = 0;
+  }
+  syncLeaderSeen = millis();
+}
+
+void receiveBeacons()
+{
+  if (beaconIp == 0)
+  {
+    return;
+  }
+  for (int i = 0; i < BEACON_READ_MAX && beaconUdp.parsePacket() > 0; i++)
+  {
+    uint64_t now = schedClock();
+    BeaconPacket packet;
+    if (beaconUdp.read((uint8_t *)&packet, sizeof(packet)) != sizeof(packet) || packet.magic[0] != 'S' ||
+        packet.magic[1] != 'B' || packet.version != BEACON_VERSION || packet.id == syncId)
+    {
+      continue;
+    }
+    beaconsReceived++;
+    if (replaying)
+    {
+      continue;
+    }
+    if (packet.id != syncLeader && packet.id > syncLeader && !syncLeaderLost())
+    {
+      continue;
+    }
+
+    followLeader(packet.id);
+    beaconOffsets[beaconOffsetNext] = packet.refUs - now;
+    beaconOffsetNext = (beaconOffsetNext + 1) % BEACON_WINDOW;
+    if (beaconOffsetCount < BEACON_WINDOW)
+    {
+      beaconOffsetCount++;
+    }
+    int64_t offset = beaconOffsets[(beaconOffsetNext + BEACON_WINDOW - 1) % BEACON_WINDOW];
+    for (int j = 0; j < beaconOffsetCount; j++)
+    {
+      int64_t o = beaconOffsets[(beaconOffsetNext + BEACON_WINDOW - 1 - j) % BEACON_WINDOW];
+      offset = o > offset ? o : offset;
+    }
+    setSyncOffset(offset);
+  }
+}
+
+void sendBeacon()
+{
+  BeaconPacket packet = {{'S', 'B'}, BEACON_VERSION, 0, syncId, syncNowUs()};
+  if (halMulticastPacket(beaconUdp, beaconGroup, BEACON_PORT))
+  {
+    beaconUdp.write((const uint8_t *)&packet, sizeof(packet));
+    if (beaconUdp.endPacket())
+    {
+      beaconsSent++;
+    }
+  }
+}
+
+void taskSync(xTaskId id)
+{
+  StackProbe probe(id);
+
+  if (syncId == 0)
+  {
+    uint8_t mac[6];
+    halWifiMac(mac);
+    syncId = (uint32_t)mac[2] << 24 | (uint32_t)mac[3] << 16 | mac[4] << 8 | mac[5];
+    syncLeader = syncId;
+  }
+
+  uint32_t ip = halWifiIp();
+  if (ip != beaconIp)
+  {
+    beaconUdp.stop();
+    if (ip != 0)
+    {
+      halMulticastBegin(beaconUdp, beaconGroup, BEACON_PORT);
+    }
+    beaconIp = ip;
+  }
+
+  // a replay shows the recorded time, it is neither sent to the others nor replaced by theirs
+  if (replaying)
+  {
+    syncValid = false;
+    return;
+  }
+
+  if (!syncLeading() && syncLeaderLost())
+  {
+    followLeader(syncId);
+  }
+  if (syncLeading() && timeValid())
+  {
+    setSyncOffset((int64_t)halWallUs() - (int64_t)schedClock());
+    if (beaconIp != 0)
+    {
+      sendBeacon();
+    }
+  }
+}
+
+void publishSyncStats()
+{
+  char stats[192];
+  snprintf(stats, sizeof(stats),
+           "{\"id\":\"%08x\",\"leader\":\"%08x\",\"valid\":%d,\"sent\":%u,\"received\":%u,\"leader_changes\":%u,"
+           "\"step_max_us\":%u}",
+           syncId, syncLeader, syncValid, beaconsSent, beaconsReceived, syncLeaderChanges, syncStepMaxUs);
+  mqttPublish(topSyncStats, stats);
+  syncStepMaxUs = 0;
+}
+
+void drawColon()
+{
+  if (colonX < 0)
+  {
+    return;
+  }
+  ProfScope scope(PROF_COLON);
+  panelGfx.setCursor(colonX, colonY);
+  panelGfx.setFont(&FreeSans12pt7b);
+  panelGfx.setTextColor(blend565(colBlack, theme->clock, clockColon));
+  panelGfx.print(":");
+}
+
+void taskColonBlink(xTaskId id)
+{
+  StackProbe probe(id);
+
+  // the colon is only drawn on top of the clock page when it is fully visible
+  if (currentPage != PAGE_CLOCK || transitionFrame >= 0)
+  {
+    return;
+  }
+
+  drawColon();
+}
+
+int brightnessFineForLight(float lux)
+{
+  int fine = minimalBrightFine + lux * 80;
+  if (fine > 255 * 16)
+  {
+    fine = 255 * 16;
+  }
+  return fine;
+}
+
+int brightnessForLight(float lux)
+{
+  return brightnessFineForLight(lux) >> 4;
+}
+
+void applyLight(float lux)
+{
+  currentLight = lux;
+  if (themeAuto)
+  {
+    setTheme(currentLight == 0 ? &themeNight : &themeDay);
+  }
+  char buff[10];
+  dtostrf(currentLight, 4, 2, buff);
+
+  rampBrightness(brightnessFineForLight(currentLight));
+
+  memset(onScreenDebugBuffer, 0, sizeof(onScreenDebugBuffer));
+  strcat(onScreenDebugBuffer, "Sen:");
+  strcat(onScreenDebugBuffer, buff);
+  strcat(onScreenDebugBuffer, "lx Bri:");
+  char cstr[4];
+  itoa(brightnessForLight(currentLight), cstr, 10);
+  strcat(onScreenDebugBuffer, cstr);
+
+  if (lightMeterDebug)
+  {
+    pageDirty[PAGE_CLOCK] = true;
+  }
+}
+
+// Values from MQTT and the sensor are not written into the model directly. They are
+// posted as commands and applied together at the start of a frame, so a frame never
+// renders half of an update. Producers are the MQTT callback and the tasks, which all
+// run in the loop context. The page task consumes, on the ESP32 from the render core;
+// the few drains from the loop hold the RenderLock, so there is one consumer at a time.
+#define CMD_TEMP_IN 0
+#define CMD_TEMP_OUT 1
+#define CMD_HUM_OUT 2
+#define CMD_FORECAST_LOW 3
+#define CMD_FORECAST_HIGH 4
+#define CMD_POWER 5
+#define CMD_ENERGY 6
+#define CMD_HEATING 7
+#define CMD_BRIGHTNESS 8
+#define CMD_LIGHT 9
+// must be a power of two
+#define COMMAND_QUEUE_SIZE 32
+
+struct Command
+{
+  uint8_t type;
+  float value;
+};
+
+Command commandQueue[COMMAND_QUEUE_SIZE];
+std::atomic<uint8_t> commandHead(0);
+std::atomic<uint8_t> commandTail(0);
+uint32_t commandsDropped = 0;
+
+unsigned int commandSpace()
+{
+  uint8_t used = commandHead.load(std::memory_order_relaxed) - commandTail.load(std::memory_order_acquire);
+  return COMMAND_QUEUE_SIZE - used;
+}
+
+bool postCommand(uint8_t type, float value)
+{
+  uint8_t head = commandHead.load(std::memory_order_relaxed);
+  if (commandSpace() == 0)
+  {
+    commandsDropped++;
+    return false;
+  }
+  commandQueue[head % COMMAND_QUEUE_SIZE] = {type, value};
+  commandHead.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+void applyCommand(const Command &c)
+{
+  switch (c.type)
+  {
+  case CMD_TEMP_IN:
+    tempIn = c.value;
+    pageDirty[PAGE_CLOCK] = true;
+    break;
+  case CMD_TEMP_OUT:
+    tempOut = c.value;
+    pageDirty[PAGE_CLOCK] = true;
+    pageDirty[PAGE_WEATHER] = true;
+    break;
+  case CMD_HUM_OUT:
+    humidityOut = c.value;
+    pageDirty[PAGE_WEATHER] = true;
+    break;
+  case CMD_FORECAST_LOW:
+    forecastLow = c.value;
+    pageDirty[PAGE_WEATHER] = true;
+    break;
+  case CMD_FORECAST_HIGH:
+    forecastHigh = c.value;
+    pageDirty[PAGE_WEATHER] = true;
+    break;
+  case CMD_POWER:
+    powerNow = c.value;
+    pageDirty[PAGE_ENERGY] = true;
+    break;
+  case CMD_ENERGY:
+    energyToday = c.value;
+    pageDirty[PAGE_ENERGY] = true;
+    break;
+  case CMD_HEATING:
+    heatingMode = (int)c.value;
+    pageDirty[PAGE_CLOCK] = true;
+    break;
+  case CMD_BRIGHTNESS:
+    rampBrightness((int)c.value << 4);
+    break;
+  case CMD_LIGHT:
+    applyLight(c.value);
+    break;
+  }
+}
+
+void drainCommands()
+{
+  uint8_t tail = commandTail.load(std::memory_order_relaxed);
+  uint8_t head = commandHead.load(std::memory_order_acquire);
+  if (tail == head)
+  {
+    return;
+  }
+  while (tail != head)
+  {
+    applyCommand(commandQueue[tail % COMMAND_QUEUE_SIZE]);
+    tail++;
+  }
+  commandTail.store(tail, std::memory_order_release);
+  publishModel();
+}
+
+#ifndef topTelemetry
+#define topTelemetry topOutPrefix "telemetry"
+#endif
+
+// light and brightness are published when they changed noticeably, otherwise only as heartbeat
+#define TELEMETRY_HEARTBEAT_MS (5UL * 60 * 1000)
+#define TELEMETRY_LUX_ABS 1.0
+#define TELEMETRY_LUX_REL 0.1
+
+float telemetryLux = -1;
+int telemetryBrightness = -1;
+unsigned long telemetryAt = 0;
+unsigned long telemetrySkipped = 0;
+
+bool telemetryChanged(const DisplayModel &model)
+{
+  float delta = fabs(model.light - telemetryLux);
+  return model.brightness != telemetryBrightness || (delta >= TELEMETRY_LUX_ABS && delta >= telemetryLux * TELEMETRY_LUX_REL);
+}
+
+void taskTelemetry(xTaskId id)
+{
+  StackProbe probe(id);
+
+  // replayed readings are not published again, while offline the outbox keeps the readings
+  if (replaying)
+  {
+    return;
+  }
+
+  DisplayModel model;
+  if (!readModel(model))
+  {
+    return;
+  }
+
+  if (telemetryAt != 0 && !telemetryChanged(model) && millis() - telemetryAt < TELEMETRY_HEARTBEAT_MS)
+  {
+    telemetrySkipped++;
+    return;
+  }
+
+  telemetryLux = model.light;
+  telemetryBrightness = model.brightness;
+  telemetryAt = millis();
+
+  // plain value for existing consumers of the sensor topic
+  char lux[10];
+  dtostrf(model.light, 4, 2, lux);
+  mqttPublish(topSensor, lux);
+
+  // the counters include this publish, except for the length of its own payload
+  char payload[160];
+  snprintf(payload, sizeof(payload),
+           "{\"lux\":%s,\"bri\":%d,\"up\":%lu,\"render_us\":%lu,\"render_max_us\":%lu,\"pubs\":%lu,\"bytes\":%lu,\"skipped\":%lu}",
+           lux, model.brightness, millis() / 1000, renderCount > 0 ? renderTotalUs / renderCount : 0, renderMaxUs,
+           publishCount + 1, publishBytes + strlen(topTelemetry), telemetrySkipped);
+  mqttPublish(topTelemetry, payload);
+}
+
+void taskSensor(xTaskId id)
+{
+  StackProbe probe(id);
+  // during a replay the light values come from the trace
+  if (BH1750Check && !replaying)
+  {
+    float lux = halLightRead();
+    traceLux(lux);
+    postCommand(CMD_LIGHT, lux);
+  }
+}
+
+// without the bitmaps the digits change without rolling
+bool digitCacheReady()
+{
+  return digitCache != NULL && digitCache->getBuffer() != NULL;
+}
+
+void initDigitCache()
+{
+  digitCache = new (std::nothrow) GFXcanvas1(DIGIT_W * 10, DIGIT_H);
+  if (!digitCacheReady())
+  {
+    return;
+  }
+  digitStride = (DIGIT_W * 10 + 7) / 8;
+  digitCache->setFont(&FreeSans12pt7b);
+  digitCache->setTextColor(1);
+  digitCache->setTextWrap(false);
+  for (int d = 0; d < 10; d++)
+  {
+    digitCache->setCursor(d * DIGIT_W, DIGIT_TOP + 16);
+    digitCache->write('0' + d);
+  }
+}
+
+void startDigitRoll(int oldHour, int oldMinute, int newHour, int newMinute)
+{
+  uint8_t from[4] = {(uint8_t)(oldHour / 10), (uint8_t)(oldHour % 10), (uint8_t)(oldMinute / 10), (uint8_t)(oldMinute % 10)};
+  uint8_t to[4] = {(uint8_t)(newHour / 10), (uint8_t)(newHour % 10), (uint8_t)(newMinute / 10), (uint8_t)(newMinute % 10)};
+
+  rollMask = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    rollFrom[i] = from[i];
+    rollTo[i] = to[i];
+    if (from[i] != to[i])
+    {
+      rollMask |= 1 << i;
+    }
+  }
+  // other pages, page transitions and layouts just pick up the new digits
+  rollFrame = rollMask && digitCacheReady() && currentPage == PAGE_CLOCK && transitionFrame < 0 && !layoutActive ? 0 : -1;
+}
+
+// the old digit moves up and out while the new one follows from below
+void drawRollCell(int cell, int frame)
+{
+  int offset = frame * DIGIT_H / ROLL_FRAMES;
+  uint16_t color = theme->clock;
+  const uint8_t *bits = digitCache->getBuffer();
+
+  for (int y = 0; y < DIGIT_H; y++)
+  {
+    int sy = y + offset;
+    int sx = rollFrom[cell] * DIGIT_W;
+    if (sy >= DIGIT_H)
+    {
+      sy -= DIGIT_H;
+      sx = rollTo[cell] * DIGIT_W;
+    }
+    const uint8_t *row = bits + sy * digitStride;
+    for (int x = 0; x < DIGIT_W; x++)
+    {
+      int bx = sx + x;
+      bool set = row[bx >> 3] & (0x80 >> (bx & 7));
+      drawPanelPixel(digitX[cell] + x, DIGIT_TOP + y, set ? color : colBlack);
+    }
+  }
+}
+
+// only changed digits are drawn, the rest of the frame stays as it is
+void drawRollFrame(int frame)
+{
+  if (!digitCacheReady())
+  {
+    return;
+  }
+  ProfScope scope(PROF_ROLL);
+  for (int i = 0; i < 4; i++)
+  {
+    if (rollMask & (1 << i))
+    {
+      drawRollCell(i, frame);
+    }
+  }
+}
+
+// the next minute of the reference, checked every frame
+uint64_t nextMinuteUs = 0;
+
+void updateClock()
+{
+  time_t now = syncTime();
+  localtime_r(&now, &lt);
+  nextMinuteUs = ((uint64_t)now / 60 + 1) * 60 * 1000000;
+
+  // redrawn by timeSynced() once the time is known
+  if (!timeValid())
+  {
+    return;
+  }
+
+  if (lt.tm_hour != currentHour || lt.tm_min != currentMinute)
+  {
+    // the first valid time replaces "--", there is nothing to roll from
+    static bool shown = false;
+    if (shown && rollDigits)
+    {
+      startDigitRoll(currentHour, currentMinute, lt.tm_hour, lt.tm_min);
+    }
+    shown = true;
+    currentHour = lt.tm_hour;
+    currentMinute = lt.tm_min;
+    pageDirty[PAGE_CLOCK] = true;
+  }
+}
+
+void taskClock(xTaskId id_)
+{
+  StackProbe probe(id_);
+  updateClock();
+}
+
+void drawDebugOverlay(Adafruit_GFX &gfx)
+{
+  if (lightMeterDebug)
+  {
+    ProfScope scope(PROF_OVERLAY);
+    gfx.setTextColor(theme->debug);
+    gfx.setFont(&TomThumb);
+    gfx.setCursor(0, 23);
+    gfx.print(memDebug ? memDebugBuffer : onScreenDebugBuffer);
+  }
+}
+
+uint16_t tempOutColor(uint16_t defaultColor)
+{
+  if (tempOut > 23)
+  {
+    return theme->warm;
+  }
+  else if (tempOut < 2)
+  {
+    return theme->cold;
+  }
+  return defaultColor;
+}
+
+void renderClockPage(Adafruit_GFX &gfx)
+{
+  int yPosMainText = 16;
+  uint16_t clockColor = theme->clock;
+  uint16_t insideTempColor = theme->text;
+
+  // the sparkline band is kept and only redrawn when the theme or scale changes
+  if (showSparkline)
+  {
+    gfx.fillRect(0, 0, 64, SPARK_TOP, colBlack);
+    if (sparkTheme != theme)
+    {
+      drawSparkline(gfx);
+    }
+  }
+  else
+  {
+    gfx.fillScreen(colBlack);
+  }
+  gfx.setTextColor(clockColor);
+  gfx.setCursor(3, yPosMainText);
+  gfx.setFont(&FreeSans12pt7b);
+  if (timeValid())
+  {
+    gfx.print(currentHour < 10 ? "0" + String(currentHour) : String(currentHour));
+  }
+  else
+  {
+    gfx.print("--");
+  }
+
+  gfx.setCursor(36, yPosMainText);
+  gfx.setTextColor(clockColor);
+  if (timeValid())
+  {
+    gfx.print(currentMinute < 10 ? "0" + String(currentMinute) : String(currentMinute));
+  }
+  else
+  {
+    gfx.print("--");
+  }
+
+  if (heatingMode > 0)
+  {
+    if (heatingMode == 1)
+    {
+      gfx.drawFastHLine(3, 19, 2, clockColor);
+      gfx.drawFastHLine(2, 20, 4, clockColor);
+      gfx.drawFastHLine(1, 21, 6, clockColor);
+      gfx.drawFastHLine(0, 22, 8, clockColor);
+    }
+    else if (heatingMode == 2)
+    {
+      uint16_t color = theme->cold;
+      gfx.drawFastHLine(0, 19, 8, color);
+      gfx.drawFastHLine(1, 20, 6, color);
+      gfx.drawFastHLine(2, 21, 4, color);
+      gfx.drawFastHLine(3, 22, 2, color);
+    }
+    else
+    {
+      uint16_t color = colBlack;
+      gfx.drawFastHLine(0, 19, 8, color);
+      gfx.drawFastHLine(0, 20, 8, color);
+      gfx.drawFastHLine(0, 21, 8, color);
+      gfx.drawFastHLine(0, 22, 8, color);
+    }
+  }
+
+  if (!showSparkline)
+  {
+    gfx.setTextColor(insideTempColor);
+    gfx.setFont(&Lato_Hairline_9);
+    gfx.setCursor(0, 32);
+    gfx.print(tempIn, 1);
+    // "$" is a degree char in my font
+    gfx.print("$C ");
+    gfx.setTextColor(tempOutColor(insideTempColor));
+    gfx.print(tempOut, 1);
+    gfx.print("$C");
+  }
+
+  drawDebugOverlay(gfx);
+}
+
+void renderWeatherPage(Adafruit_GFX &gfx)
+{
+  uint16_t textColor = theme->text;
+
+  gfx.fillScreen(colBlack);
+  gfx.setTextColor(tempOutColor(textColor));
+  gfx.setFont(&FreeSans12pt7b);
+  gfx.setCursor(0, 16);
+  gfx.print(tempOut, 1);
+  gfx.setFont(&Lato_Hairline_9);
+  gfx.print("$C");
+
+  gfx.setTextColor(textColor);
+  gfx.setCursor(0, 32);
+  gfx.print(humidityOut, 0);
+  gfx.print("% ");
+  gfx.print(forecastLow, 0);
+  gfx.print("/");
+  gfx.print(forecastHigh, 0);
+  gfx.print("$C");
+}
+
+void renderEnergyPage(Adafruit_GFX &gfx)
+{
+  uint16_t textColor = theme->text;
+
+  gfx.fillScreen(colBlack);
+  gfx.setTextColor(theme->clock);
+  gfx.setFont(&FreeSans12pt7b);
+  gfx.setCursor(0, 16);
+  gfx.print((int)powerNow);
+  gfx.setFont(&Lato_Hairline_9);
+  gfx.print("W");
+
+  gfx.setTextColor(textColor);
+  gfx.setCursor(0, 32);
+  gfx.print(energyToday, 1);
+  gfx.print("kWh");
+}
+
+#ifndef topLayout
+#define topLayout "home/sz/display/layout"
+#endif
+#ifndef topLayoutStatus
+#define topLayoutStatus topOutPrefix "layoutstatus"
+#endif
+
+// Layout bytecode, compiled from a text description by tools/layoutc.py:
+//   header     'L' 'Y' version
+//   LABEL      font color x y length chars           static text, drawn once
+//   TEXT       var font color x y format length chars variable with a suffix of up to 4 chars
+//   THRESHOLD  below(int16) color above(int16) color  colors the previous TEXT, values in 0.1
+//   ICON       icon var color x y
+//   COLON      x y                                    where the blinking colon goes
+// Fonts: 0 FreeSans12pt7b, 1 Lato_Hairline_9, 2 TomThumb
+// Colors are theme slots: 0 clock, 1 text, 2 warm, 3 cold, 4 debug
+#define LAYOUT_FILE "/layout.bin"
+#define LAYOUT_VERSION 1
+// PubSubClient buffers 256 bytes including the topic
+#define LAYOUT_MAX_BYTES 200
+#define LAYOUT_MAX_WIDGETS 16
+#define LAYOUT_MAX_LABEL 12
+
+#define OP_LABEL 1
+#define OP_TEXT 2
+#define OP_THRESHOLD 3
+#define OP_ICON 4
+#define OP_COLON 5
+
+#define VAR_HOUR 0
+#define VAR_MINUTE 1
+#define VAR_TEMP_IN 2
+#define VAR_TEMP_OUT 3
+#define VAR_HUMIDITY 4
+#define VAR_FORECAST_LOW 5
+#define VAR_FORECAST_HIGH 6
+#define VAR_POWER 7
+#define VAR_ENERGY 8
+#define VAR_LIGHT 9
+#define VAR_HEATING 10
+#define VAR_COUNT 11
+
+#define ICON_HEATING 0
+#define ICON_COUNT 1
+
+// format: decimals in the low two bits, FORMAT_PAD2 prints integers with two digits
+#define FORMAT_DECIMALS 0x03
+#define FORMAT_PAD2 0x04
+
+#define LAYOUT_FONTS 3
+#define LAYOUT_COLORS 5
+const GFXfont *layoutFonts[LAYOUT_FONTS] = {&FreeSans12pt7b, &Lato_Hairline_9, &TomThumb};
+
+struct LayoutWidget
+{
+  uint8_t op;
+  uint8_t var;
+  uint8_t font;
+  uint8_t color;
+  uint8_t icon;
+  int8_t x;
+  int8_t y;
+  uint8_t format;
+  // label text or suffix of a TEXT widget
+  char text[LAYOUT_MAX_LABEL + 1];
+  bool thresholds;
+  int16_t below;
+  uint8_t belowColor;
+  int16_t above;
+  uint8_t aboveColor;
+  // what is on the canvas, only widgets whose value or color changed are drawn again
+  bool drawn;
+  int32_t lastValue;
+  uint16_t lastColor;
+  int16_t boundsX;
+  int16_t boundsY;
+  uint16_t boundsW;
+  uint16_t boundsH;
+};
+
+struct Layout
+{
+  uint8_t count;
+  LayoutWidget widgets[LAYOUT_MAX_WIDGETS];
+  int8_t colonX;
+  int8_t colonY;
+  // the static parts are drawn with this theme, NULL draws everything again
+  const Theme *theme;
+  // the debug overlay was drawn on top in the last render
+  bool overlay;
+};
+
+Layout layout;
+// temporary copy for decoding, a broken layout must not replace the working one
+Layout layoutDecoded;
+const char *layoutError = "";
+
+// the built-in face as layout, for comparing the interpreter with renderClockPage
+const uint8_t layoutBuiltin[] = {
+    'L', 'Y', LAYOUT_VERSION,
+    OP_TEXT, VAR_HOUR, 0, 0, 3, 16, FORMAT_PAD2, 0,
+    OP_TEXT, VAR_MINUTE, 0, 0, 36, 16, FORMAT_PAD2, 0,
+    OP_ICON, ICON_HEATING, VAR_HEATING, 0, 0, 19,
+    OP_TEXT, VAR_TEMP_IN, 1, 1, 0, 32, 1, 2, '$', 'C',
+    OP_TEXT, VAR_TEMP_OUT, 1, 1, 34, 32, 1, 2, '$', 'C',
+    OP_THRESHOLD, 20, 0, 3, 230, 0, 2,
+    OP_COLON, 29, 14};
+
+uint16_t themeColor(uint8_t slot)
+{
+  const uint16_t colors[LAYOUT_COLORS] = {theme->clock, theme->text, theme->warm, theme->cold, theme->debug};
+  return colors[slot];
+}
+
+float layoutValue(uint8_t var)
+{
+  switch (var)
+  {
+  case VAR_HOUR:
+    return currentHour;
+  case VAR_MINUTE:
+    return currentMinute;
+  case VAR_TEMP_IN:
+    return tempIn;
+  case VAR_TEMP_OUT:
+    return tempOut;
+  case VAR_HUMIDITY:
+    return humidityOut;
+  case VAR_FORECAST_LOW:
+    return forecastLow;
+  case VAR_FORECAST_HIGH:
+    return forecastHigh;
+  case VAR_POWER:
+    return powerNow;
+  case VAR_ENERGY:
+    return energyToday;
+  case VAR_LIGHT:
+    return currentLight;
+  case VAR_HEATING:
+    return heatingMode;
+  }
+  return 0;
+}
+
+bool layoutFail(const char *error)
+{
+  layoutError = error;
+  return false;
+}
+
+// checks everything once here, the interpreter trusts the decoded widgets
+bool layoutDecode(const uint8_t *code, unsigned int length, Layout &out)
+{
+  if (length < 3 || length > LAYOUT_MAX_BYTES || code[0] != 'L' || code[1] != 'Y')
+  {
+    return layoutFail("header");
+  }
+  if (code[2] != LAYOUT_VERSION)
+  {
+    return layoutFail("version");
+  }
+
+  memset(&out, 0, sizeof(out));
+  out.colonX = -1;
+  out.colonY = -1;
+  unsigned int pos = 3;
+  while (pos < length)
+  {
+    uint8_t op = code[pos];
+    const uint8_t *args = code + pos + 1;
+    unsigned int left = length - pos - 1;
+
+    if (op == OP_COLON)
+    {
+      if (left < 2)
+      {
+        return layoutFail("truncated");
+      }
+      out.colonX = (int8_t)args[0];
+      out.colonY = (int8_t)args[1];
+      pos += 3;
+      continue;
+    }
+
+    if (op == OP_THRESHOLD)
+    {
+      if (left < 6)
+      {
+        return layoutFail("truncated");
+      }
+      if (out.count == 0 || out.widgets[out.count - 1].op != OP_TEXT)
+      {
+        return layoutFail("threshold without text");
+      }
+      LayoutWidget &w = out.widgets[out.count - 1];
+      w.thresholds = true;
+      w.below = (int16_t)(args[0] | args[1] << 8);
+      w.belowColor = args[2];
+      w.above = (int16_t)(args[3] | args[4] << 8);
+      w.aboveColor = args[5];
+      if (w.belowColor >= LAYOUT_COLORS || w.aboveColor >= LAYOUT_COLORS)
+      {
+        return layoutFail("color");
+      }
+      pos += 7;
+      continue;
+    }
+
+    if (out.count >= LAYOUT_MAX_WIDGETS)
+    {
+      return layoutFail("too many widgets");
+    }
+    LayoutWidget &w = out.widgets[out.count];
+    w.op = op;
+    unsigned int size;
+    if (op == OP_LABEL)
+    {
+      if (left < 5 || left < 5u + args[4])
+      {
+        return layoutFail("truncated");
+      }
+      if (args[4] > LAYOUT_MAX_LABEL)
+      {
+        return layoutFail("label");
+      }
+      w.font = args[0];
+      w.color = args[1];
+      w.x = (int8_t)args[2];
+      w.y = (int8_t)args[3];
+      memcpy(w.text, args + 5, args[4]);
+      size = 5 + args[4];
+    }
+    else if (op == OP_TEXT)
+    {
+      if (left < 7 || left < 7u + args[6])
+      {
+        return layoutFail("truncated");
+      }
+      if (args[6] > 4)
+      {
+        return layoutFail("suffix");
+      }
+      w.var = args[0];
+      w.font = args[1];
+      w.color = args[2];
+      w.x = (int8_t)args[3];
+      w.y = (int8_t)args[4];
+      w.format = args[5];
+      memcpy(w.text, args + 7, args[6]);
+      size = 7 + args[6];
+    }
+    else if (op == OP_ICON)
+    {
+      if (left < 5)
+      {
+        return layoutFail("truncated");
+      }
+      w.icon = args[0];
+      w.var = args[1];
+      w.color = args[2];
+      w.x = (int8_t)args[3];
+      w.y = (int8_t)args[4];
+      if (w.icon >= ICON_COUNT)
+      {
+        return layoutFail("icon");
+      }
+      size = 5;
+    }
+    else
+    {
+      return layoutFail("opcode");
+    }
+
+    if (w.var >= VAR_COUNT)
+    {
+      return layoutFail("variable");
+    }
+    if (w.font >= LAYOUT_FONTS)
+    {
+      return layoutFail("font");
+    }
+    if (w.color >= LAYOUT_COLORS)
+    {
+      return layoutFail("color");
+    }
+    if (w.x < 0 || w.x >= 64 || w.y < 0 || w.y > 32)
+    {
+      return layoutFail("position");
+    }
+    out.count++;
+    pos += 1 + size;
+  }
+  return true;
+}
+
+void drawHeatingIcon(Adafruit_GFX &gfx, int x, int y, int mode, uint16_t color)
+{
+  if (mode == 1)
+  {
+    gfx.drawFastHLine(x + 3, y, 2, color);
+    gfx.drawFastHLine(x + 2, y + 1, 4, color);
+    gfx.drawFastHLine(x + 1, y + 2, 6, color);
+    gfx.drawFastHLine(x, y + 3, 8, color);
+  }
+  else if (mode == 2)
+  {
+    color = theme->cold;
+    gfx.drawFastHLine(x, y, 8, color);
+    gfx.drawFastHLine(x + 1, y + 1, 6, color);
+    gfx.drawFastHLine(x + 2, y + 2, 4, color);
+    gfx.drawFastHLine(x + 3, y + 3, 2, color);
+  }
+}
+
+// Static labels are drawn only after a theme change or a new layout, a widget bound
+// to a variable only when its value at the shown precision or its color changed.
+void renderLayout(Adafruit_GFX &gfx, Layout &l)
+{
+  static const int32_t scale[4] = {1, 10, 100, 1000};
+  // the overlay overlaps the widgets, while it is shown or was just hidden everything is redrawn
+  bool full = l.theme != theme || lightMeterDebug || l.overlay;
+  if (full)
+  {
+    gfx.fillScreen(colBlack);
+    l.theme = theme;
+  }
+  l.overlay = lightMeterDebug;
+
+  for (int i = 0; i < l.count; i++)
+  {
+    LayoutWidget &w = l.widgets[i];
+    uint16_t color = themeColor(w.color);
+    float value = layoutValue(w.var);
+
+    if (w.op == OP_LABEL)
+    {
+      if (full)
+      {
+        gfx.setFont(layoutFonts[w.font]);
+        gfx.setTextColor(color);
+        gfx.setCursor(w.x, w.y);
+        gfx.print(w.text);
+      }
+      continue;
+    }
+
+    int decimals = w.format & FORMAT_DECIMALS;
+    bool noTime = (w.var == VAR_HOUR || w.var == VAR_MINUTE) && !timeValid();
+    int32_t scaled = noTime ? INT32_MIN : lroundf(value * scale[decimals]);
+    if (w.thresholds && value * 10 < w.below)
+    {
+      color = themeColor(w.belowColor);
+    }
+    else if (w.thresholds && value * 10 > w.above)
+    {
+      color = themeColor(w.aboveColor);
+    }
+    if (!full && w.drawn && scaled == w.lastValue && color == w.lastColor)
+    {
+      continue;
+    }
+
+    if (w.drawn && !full)
+    {
+      gfx.fillRect(w.boundsX, w.boundsY, w.boundsW, w.boundsH, colBlack);
+    }
+    w.drawn = true;
+    w.lastValue = scaled;
+    w.lastColor = color;
+
+    if (w.op == OP_ICON)
+    {
+      w.boundsX = w.x;
+      w.boundsY = w.y;
+      w.boundsW = 8;
+      w.boundsH = 4;
+      drawHeatingIcon(gfx, w.x, w.y, (int)value, color);
+      continue;
+    }
+
+    char buf[24];
+    if (noTime)
+    {
+      strcpy(buf, "--");
+    }
+    else if (w.format & FORMAT_PAD2)
+    {
+      snprintf(buf, sizeof(buf), "%02d", (int)value);
+    }
+    else
+    {
+      dtostrf(value, 1, decimals, buf);
+    }
+    strncat(buf, w.text, sizeof(buf) - strlen(buf) - 1);
+
+    gfx.setFont(layoutFonts[w.font]);
+    gfx.setTextColor(color);
+    gfx.getTextBounds(buf, w.x, w.y, &w.boundsX, &w.boundsY, &w.boundsW, &w.boundsH);
+    gfx.setCursor(w.x, w.y);
+    gfx.print(buf);
+  }
+  drawDebugOverlay(gfx);
+}
+
+void activateLayout(bool active)
+{
+  layoutActive = active;
+  layout.theme = NULL;
+  colonX = active ? layout.colonX : 29;
+  colonY = active ? layout.colonY : 14;
+  rollFrame = -1;
+  sparkTheme = NULL;
+  pageDirty[PAGE_CLOCK] = true;
+}
+
+void loadLayout()
+{
+  uint8_t code[LAYOUT_MAX_BYTES];
+  HalFile f = halFsOpen(LAYOUT_FILE, "r");
+  if (!f)
+  {
+    return;
+  }
+  int length = f.read(code, sizeof(code));
+  f.close();
+  if (length > 0 && layoutDecode(code, length, layout))
+  {
+    activateLayout(true);
+  }
+}
+
+// an empty payload goes back to the built-in face
+void onLayout(const byte *payload, unsigned int length)
+{
+  // a replay switches layouts without storing them, the stored one comes back at its end
+  if (length == 0)
+  {
+    if (!replaying)
+    {
+      halFsRemove(LAYOUT_FILE);
+    }
+    activateLayout(false);
+    mqttPublish(topLayoutStatus, "builtin");
+    return;
+  }
+
+  if (!layoutDecode(payload, length, layoutDecoded))
+  {
+    mqttPublish(topLayoutStatus, layoutError);
+    return;
+  }
+  layout = layoutDecoded;
+  if (!replaying)
+  {
+    HalFile f = halFsOpen(LAYOUT_FILE, "w");
+    if (f)
+    {
+      f.write(payload, length);
+      f.close();
+    }
+  }
+  activateLayout(true);
+  mqttPublish(topLayoutStatus, "ok");
+}
+
+void renderPage(int page)
+{
+  if (!pageOnCanvas(page))
+  {
+    return;
+  }
+  profCanvasBegin();
+  switch (page)
+  {
+  case PAGE_CLOCK:
+    if (layoutActive)
+    {
+      ProfScope scope(PROF_LAYOUT);
+      renderLayout(*pageCanvas[page], layout);
+    }
+    else
+    {
+      ProfScope scope(PROF_CLOCK);
+      renderClockPage(*pageCanvas[page]);
+    }
+    break;
+  case PAGE_WEATHER:
+  {
+    ProfScope scope(PROF_WEATHER);
+    renderWeatherPage(*pageCanvas[page]);
+    break;
+  }
+  case PAGE_ENERGY:
+  {
+    ProfScope scope(PROF_ENERGY);
+    renderEnergyPage(*pageCanvas[page]);
+    break;
+  }
+  }
+}
+
+void blitPage(int page)
+{
+  if (!pageOnCanvas(page))
+  {
+    return;
+  }
+  ProfScope scope(PROF_BLIT);
+  const uint16_t *buf = pageCanvas[page]->getBuffer();
+  bool rolling = page == PAGE_CLOCK && rollFrame >= 0;
+
+  // columns of rolling digit cells, the canvas already holds the new digits there
+  uint64_t skip = 0;
+  if (rolling)
+  {
+    for (int i = 0; i < 4; i++)
+    {
+      if (rollMask & (1 << i))
+      {
+        skip |= (((uint64_t)1 << DIGIT_W) - 1) << digitX[i];
+      }
+    }
+  }
+
+  for (int y = 0; y < 32; y++)
+  {
+    bool band = y >= DIGIT_TOP && y < DIGIT_TOP + DIGIT_H;
+    for (int x = 0; x < 64; x++)
+    {
+      if (band && (skip >> x) & 1)
+      {
+        continue;
+      }
+      drawPanelPixel(x, y, buf[y * 64 + x]);
+    }
+  }
+  if (rolling)
+  {
+    drawRollFrame(rollFrame);
+  }
+  if (page == PAGE_CLOCK)
+  {
+    drawColon();
+  }
+}
+
+void drawTransitionFrame(int from, int to, int frame)
+{
+  ProfScope scope(PROF_TRANSITION);
+  const uint16_t *a = pageCanvas[from]->getBuffer();
+  const uint16_t *b = pageCanvas[to]->getBuffer();
+
+  if (transitionType == TRANSITION_FADE)
+  {
+    uint8_t alpha = frame * 32 / TRANSITION_STEPS;
+    for (int y = 0; y < 32; y++)
+    {
+      for (int x = 0; x < 64; x++)
+      {
+        int i = y * 64 + x;
+        drawPanelPixel(x, y, blend565(a[i], b[i], alpha));
+      }
+    }
+  }
+  else
+  {
+    // the new page pushes the old one out to the left
+    int shift = frame * 64 / TRANSITION_STEPS;
+    for (int y = 0; y < 32; y++)
+    {
+      for (int x = 0; x < 64; x++)
+      {
+        int sx = x + shift;
+        drawPanelPixel(x, y, sx < 64 ? a[y * 64 + sx] : b[y * 64 + sx - 64]);
+      }
+    }
+  }
+}
+
+void taskPages(xTaskId id)
+{
+  StackProbe probe(id);
+  profFrameBegin();
+  drainCommands();
+  updateTweens(schedClock());
+  // the minute changes with the reference instead of with the next clock task run
+  if (syncValid && syncNowUs() >= nextMinuteUs)
+  {
+    updateClock();
+  }
+  // from the frame drawn in the previous run
+  updatePowerLimit();
+
+  // text rendering only happens here and only for pages whose data changed
+  for (int i = 0; i < PAGE_COUNT; i++)
+  {
+    if (pageDirty[i] && pageOnCanvas(i))
+    {
+      unsigned long start = micros();
+      renderPage(i);
+      unsigned long elapsed = micros() - start;
+      renderCount++;
+      renderTotalUs += elapsed;
+      if (elapsed > renderMaxUs)
+      {
+        renderMaxUs = elapsed;
+      }
+      pageDirty[i] = false;
+      if (i == currentPage)
+      {
+        frameDirty = true;
+      }
+    }
+  }
+
+  if (transitionFrame >= 0)
+  {
+    if (tweenFind(transitionTween) != NULL)
+    {
+      drawTransitionFrame(currentPage, nextPage, transitionFrame);
+      return;
+    }
+    currentPage = nextPage;
+    transitionFrame = -1;
+    frameDirty = true;
+    pageShownAt = millis();
+  }
+
+  int wanted = currentPage;
+  if (pinnedPage >= 0)
+  {
+    wanted = pinnedPage;
+  }
+  else if (pageRotateMs > 0 && millis() - pageShownAt >= pageRotateMs)
+  {
+    wanted = (currentPage + 1) % PAGE_COUNT;
+  }
+
+  if (wanted != currentPage && canvasShared)
+  {
+    // the shared canvas is drawn again with the new page, the layout and the sparkline
+    // are not on it anymore
+    currentPage = wanted;
+    pageShownAt = millis();
+    rollFrame = -1;
+    layout.theme = NULL;
+    sparkTheme = NULL;
+    renderPage(currentPage);
+    pageDirty[currentPage] = false;
+    frameDirty = true;
+  }
+  else if (wanted != currentPage)
+  {
+    nextPage = wanted;
+    transitionFrame = 0;
+    transitionTween = tweenStart(0, TRANSITION_STEPS, TRANSITION_US, EASE_IN_OUT, 0, [](int32_t progress) { transitionFrame = progress; });
+    rollFrame = -1;
+    drawTransitionFrame(currentPage, nextPage, transitionFrame);
+    return;
+  }
+
+  // the last frame shows the new digits completely, the roll ends one tick later
+  if (rollFrame >= 0)
+  {
+    rollFrame++;
+    if (rollFrame > ROLL_FRAMES)
+    {
+      rollFrame = -1;
+    }
+    else if (!frameDirty)
+    {
+      drawRollFrame(rollFrame);
+    }
+  }
+
+  if (frameDirty)
+  {
+    blitPage(currentPage);
+    frameDirty = false;
+  }
+}
+
+int pageByName(const char *name)
+{
+  for (int i = 0; i < PAGE_COUNT; i++)
+  {
+    if (strcmp(name, pageNames[i]) == 0)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+#ifndef topSchedStats
+#define topSchedStats topOutPrefix "schedstats"
+#endif
+
+// HeliOS only runs the dispatcher, periods, priorities, deadlines and budgets are handled here
+#define SCHED_MAX_TASKS 16
+#define MQTT_LOOP_BUDGET_US 10000
+
+struct SchedTask
+{
+  const char *name;
+  void (*run)(xTaskId);
+  uint64_t periodUs;
+  // relative to the release, equal to the period
+  uint64_t deadlineUs;
+  uint32_t budgetUs;
+  // higher runs first, equal priorities run earliest release first
+  uint8_t priority;
+  uint64_t release;
+  uint32_t runs;
+  uint32_t deadlineMisses;
+  uint32_t budgetOverruns;
+  // periods dropped because the task was more than a period late
+  uint32_t skipped;
+  uint32_t maxUs;
+  bool suspended;
+};
+
+SchedTask schedTasks[SCHED_MAX_TASKS];
+int schedTaskCount = 0;
+uint32_t mqttLoopOverruns = 0;
+uint32_t mqttLoopMaxUs = 0;
+char schedStats[512];
+
+xTaskId addTask(const char *name, void (*task)(xTaskId), uint64_t periodUs, uint8_t priority, uint32_t budgetUs)
+{
+  if (schedTaskCount >= SCHED_MAX_TASKS)
+  {
+    return TASK_DIRECT;
+  }
+
+  SchedTask &t = schedTasks[schedTaskCount];
+  memset(&t, 0, sizeof(t));
+  t.name = name;
+  t.run = task;
+  t.periodUs = periodUs;
+  t.deadlineUs = periodUs;
+  t.budgetUs = budgetUs;
+  t.priority = priority;
+  t.release = schedClock() + periodUs;
+  if (CTX_TASKS + schedTaskCount < CTX_COUNT)
+  {
+    ctxNames[CTX_TASKS + schedTaskCount] = name;
+  }
+  return schedTaskCount++;
+}
+
+// a resumed task is due right away
+void suspendTask(xTaskId id, bool suspended)
+{
+  if (id < 0 || id >= schedTaskCount)
+  {
+    return;
+  }
+  schedTasks[id].suspended = suspended;
+  if (!suspended)
+  {
+    schedTasks[id].release = schedClock();
+  }
+}
+
+// runs one due task per call so mqttClient.loop() gets time between two tasks
+void taskSched(xTaskId id)
+{
+  uint64_t now = schedClock();
+  int next = -1;
+  for (int i = 0; i < schedTaskCount; i++)
+  {
+    SchedTask &t = schedTasks[i];
+    if (t.suspended || now < t.release)
+    {
+      continue;
+    }
+    if (next < 0 || t.priority > schedTasks[next].priority ||
+        (t.priority == schedTasks[next].priority && t.release < schedTasks[next].release))
+    {
+      next = i;
+    }
+  }
+  if (next < 0)
+  {
+    return;
+  }
+
+  SchedTask &t = schedTasks[next];
+  t.run(next);
+  uint64_t end = schedClock();
+  uint32_t elapsed = end - now;
+
+  t.runs++;
+  if (elapsed > t.maxUs)
+  {
+    t.maxUs = elapsed;
+  }
+  if (elapsed > t.budgetUs)
+  {
+    t.budgetOverruns++;
+  }
+  if (end - t.release > t.deadlineUs)
+  {
+    t.deadlineMisses++;
+  }
+
+  // the next release is the first period boundary after the end, so a late task runs once
+  // and every release it overran is dropped instead of run back to back
+  uint64_t periods = (end - t.release) / t.periodUs + 1;
+  t.skipped += periods - 1;
+  t.release += periods * t.periodUs;
+}
+
+void publishSchedStats()
+{
+  // per task: runs, deadline misses, budget overruns, skipped periods, max run time in us
+  int len = snprintf(schedStats, sizeof(schedStats), "{");
+  for (int i = 0; i < schedTaskCount && len < (int)sizeof(schedStats); i++)
+  {
+    SchedTask &t = schedTasks[i];
+    len += snprintf(schedStats + len, sizeof(schedStats) - len, "\"%s\":[%u,%u,%u,%u,%u],",
+                    t.name, t.runs, t.deadlineMisses, t.budgetOverruns, t.skipped, t.maxUs);
+  }
+  if (len < (int)sizeof(schedStats))
+  {
+    len += snprintf(schedStats + len, sizeof(schedStats) - len, "\"mqtt\":[%u,%u]}", mqttLoopOverruns, mqttLoopMaxUs);
+  }
+  if (len >= (int)sizeof(schedStats))
+  {
+    return;
+  }
+  mqttPublishLarge(topSchedStats, schedStats, len);
+}
+
+#ifndef topNightSchedule
+#define topNightSchedule "home/sz/display/nightschedule"
+#endif
+#ifndef topNightLux
+#define topNightLux "home/sz/display/nightlux"
+#endif
+#ifndef topWake
+#define topWake "home/sz/display/wake"
+#endif
+#ifndef topNightStats
+#define topNightStats topOutPrefix "nightstats"
+#endif
+
+// a wake request keeps the display on for this long, whatever the schedule says
+#define WAKE_HOLD_MS (10UL * 60 * 1000)
+// loop() hands this much time per pass to the SDK while blanked
+#define NIGHT_IDLE_MS 50
+// panel drivers idle plus the ESP in modem sleep, there is no current sensor
+#define POWER_BLANK_MA 40
+
+xTaskId taskColId = TASK_DIRECT;
+xTaskId taskPageId = TASK_DIRECT;
+// minutes of the day, blanked from start to end, may wrap over midnight
+bool nightScheduleOn = false;
+int nightStart = 0;
+int nightEnd = 0;
+// 0 = not triggered by the light sensor
+int nightLuxMinutes = 0;
+unsigned long darkSince = 0;
+unsigned long wakeHoldUntil = 0;
+unsigned long blankedAt = 0;
+uint32_t blankedSeconds = 0;
+uint32_t wakeLatencyUs = 0;
+// estimated current, averaged over the seconds since the last stats
+uint32_t nightMaSum = 0;
+uint32_t nightMaSamples = 0;
+
+void publishNightStats()
+{
+  char stats[128];
+  snprintf(stats, sizeof(stats), "{\"blanked\":%d,\"avg_ma\":%u,\"blanked_s\":%u,\"wake_us\":%u}",
+           nightBlanked, nightMaSamples > 0 ? nightMaSum / nightMaSamples : 0,
+           blankedSeconds + (nightBlanked ? (uint32_t)(millis() - blankedAt) / 1000 : 0), wakeLatencyUs);
+  mqttPublish(topNightStats, stats);
+}
+
+void nightBlank()
+{
+  nightBlanked = true;
+  blankedAt = millis();
+  suspendTask(taskColId, true);
+  suspendTask(taskPageId, true);
+  tweenStop(transitionTween);
+  transitionFrame = -1;
+  rollFrame = -1;
+  display_update_enable(false);
+  halPanelBlank(true);
+  halModemSleep(true);
+  publishNightStats();
+}
+
+// the current page is drawn right here instead of waiting for the page task
+void nightWake()
+{
+  unsigned long start = micros();
+  nightBlanked = false;
+  halModemSleep(false);
+  display_update_enable(true);
+  applyBrightness();
+  drainCommands();
+  if (pageDirty[currentPage])
+  {
+    renderPage(currentPage);
+    pageDirty[currentPage] = false;
+  }
+  blitPage(currentPage);
+  frameDirty = false;
+  suspendTask(taskColId, false);
+  suspendTask(taskPageId, false);
+  wakeLatencyUs = micros() - start;
+  blankedSeconds += (millis() - blankedAt) / 1000;
+  publishNightStats();
+}
+
+bool nightDue()
+{
+  if (wakeHoldUntil != 0 && (long)(millis() - wakeHoldUntil) < 0)
+  {
+    return false;
+  }
+  wakeHoldUntil = 0;
+
+  if (nightScheduleOn && timeValid())
+  {
+    time_t now = halTime();
+    struct tm local;
+    localtime_r(&now, &local);
+    int minute = local.tm_hour * 60 + local.tm_min;
+    bool inside = nightStart <= nightEnd ? minute >= nightStart && minute < nightEnd
+                                         : minute >= nightStart || minute < nightEnd;
+    if (inside)
+    {
+      return true;
+    }
+  }
+  return nightLuxMinutes > 0 && darkSince != 0 && millis() - darkSince >= nightLuxMinutes * 60000UL;
+}
+
+void taskNight(xTaskId id)
+{
+  StackProbe probe(id);
+  // the page task is suspended, sensor values still have to reach the model
+  if (nightBlanked)
+  {
+    drainCommands();
+  }
+
+  if (currentLight > 0)
+  {
+    darkSince = 0;
+  }
+  else if (darkSince == 0)
+  {
+    darkSince = millis();
+  }
+
+  bool due = nightDue();
+  if (due && !nightBlanked)
+  {
+    nightBlank();
+  }
+  else if (!due && nightBlanked)
+  {
+    nightWake();
+  }
+
+  nightMaSum += nightBlanked ? POWER_BLANK_MA : powerEstimateMa();
+  nightMaSamples++;
+}
+
+// "01:00-06:00", anything else switches the schedule off
+void onNightSchedule(char *payload)
+{
+  int startHour, startMinute, endHour, endMinute;
+  nightScheduleOn = sscanf(payload, "%d:%d-%d:%d", &startHour, &startMinute, &endHour, &endMinute) == 4;
+  if (nightScheduleOn)
+  {
+    nightStart = startHour * 60 + startMinute;
+    nightEnd = endHour * 60 + endMinute;
+  }
+}
+
+void onNightLux(char *payload)
+{
+  nightLuxMinutes = atoi(payload);
+}
+
+void onWake(char *)
+{
+  wakeHoldUntil = millis() + WAKE_HOLD_MS;
+  if (nightBlanked)
+  {
+    nightWake();
+  }
+}
+
+#ifndef topDisplayPrefix
+#define topDisplayPrefix "home/sz/display/"
+#endif
+#ifndef topReconnectStats
+#define topReconnectStats topOutPrefix "reconnect"
+#endif
+#define PREFIX_LENGTH (sizeof(topDisplayPrefix) - 1)
+// values that did not arrive within this time after a reconnect are reported as missing
+#define POPULATE_TIMEOUT_MS 10000
+
+void onTempIn(char *payload)
+{
+  postCommand(CMD_TEMP_IN, atof(payload));
+}
+
+void onTempOut(char *payload)
+{
+  postCommand(CMD_TEMP_OUT, atof(payload));
+}
+
+// sets brightness of the screen, will be overwritten almost immediately by the sensor values
+void onBright(char *payload)
+{
+  postCommand(CMD_BRIGHTNESS, atoi(payload));
+}
+
+// sets minimal brightness of the screen (used if sensor says zero light), fractions like "3.5" are dithered
+void onMinimalBright(char *payload)
+{
+  minimalBrightFine = std::max(0L, lroundf(atof(payload) * 16));
+}
+
+// enable/disable the debug overlay, "1" shows light sensor and brightness, "2" memory information
+void onLightMeterDebug(char *payload)
+{
+  lightMeterDebug = strcmp(payload, "1") == 0 || strcmp(payload, "2") == 0;
+  memDebug = strcmp(payload, "2") == 0;
+  memDebugBuffer[0] = '\0';
+  pageDirty[PAGE_CLOCK] = true;
+}
+
+// flag for cooling indicator
+void onCool(char *payload)
+{
+  postCommand(CMD_HEATING, strcmp(payload, "On") == 0 ? 2 : 0);
+}
+
+// flag for heating indicator
+void onHeat(char *payload)
+{
+  postCommand(CMD_HEATING, strcmp(payload, "1") == 0 ? 1 : 0);
+}
+
+void onHumOut(char *payload)
+{
+  postCommand(CMD_HUM_OUT, atof(payload));
+}
+
+void onPower(char *payload)
+{
+  postCommand(CMD_POWER, atof(payload));
+}
+
+void onEnergyToday(char *payload)
+{
+  postCommand(CMD_ENERGY, atof(payload));
+}
+
+// pins a page by name ("clock", "weather", "energy"), anything else resumes rotation
+void onPage(char *payload)
+{
+  pinnedPage = pageByName(payload);
+}
+
+// seconds per page, 0 disables the rotation
+void onPageRotate(char *payload)
+{
+  pageRotateMs = (unsigned long)atoi(payload) * 1000;
+  pageShownAt = millis();
+}
+
+// "fade" or "slide"
+void onPageTransition(char *payload)
+{
+  transitionType = strcmp(payload, "fade") == 0 ? TRANSITION_FADE : TRANSITION_SLIDE;
+}
+
+// "auto" follows the light sensor, otherwise a theme name ("day", "night" or a user theme)
+void onTheme(char *payload)
+{
+  if (strcmp(payload, "auto") == 0)
+  {
+    themeAuto = true;
+    setTheme(currentLight == 0 ? &themeNight : &themeDay);
+  }
+  else
+  {
+    const Theme *t = themeByName(payload);
+    if (t != NULL)
+    {
+      themeAuto = false;
+      setTheme(t);
+    }
+  }
+}
+
+// refresh interval in microseconds, rejected if the row scan does not fit
+void onRefresh(char *payload)
+{
+  if (!setRefreshInterval(atoi(payload)))
+  {
+    publishRefreshStats();
+  }
+}
+
+// "1" spreads fractional brightness over frames, "0" uses whole steps only
+void onDither(char *payload)
+{
+  ditherEnabled = strcmp(payload, "1") == 0;
+  applyBrightness();
+}
+
+void onRollDigits(char *payload)
+{
+  rollDigits = strcmp(payload, "1") == 0;
+}
+
+void onSparkline(char *payload)
+{
+  showSparkline = strcmp(payload, "1") == 0;
+  sparkTheme = NULL;
+  pageDirty[PAGE_CLOCK] = true;
+}
+
+void onPowerBudget(char *payload)
+{
+  powerBudgetMa = atoi(payload);
+  updatePowerLimit();
+}
+
+void onThemeDefine(char *payload)
+{
+  defineTheme(payload);
+}
+
+#ifndef topMulti
+#define topMulti "home/sz/display/multi"
+#endif
+
+// parses a number from a span that is not terminated, e.g. directly from an MQTT payload
+bool parseNumber(const char *s, unsigned int length, float &out)
+{
+  unsigned int i = 0;
+  bool negative = false;
+  if (i < length && (s[i] == '-' || s[i] == '+'))
+  {
+    negative = s[i] == '-';
+    i++;
+  }
+
+  float value = 0;
+  // 0 until the decimal point was seen
+  float scale = 0;
+  bool digits = false;
+  for (; i < length; i++)
+  {
+    if (s[i] >= '0' && s[i] <= '9')
+    {
+      digits = true;
+      if (scale == 0)
+      {
+        value = value * 10 + (s[i] - '0');
+      }
+      else
+      {
+        value += (s[i] - '0') * scale;
+        scale /= 10;
+      }
+    }
+    else if (s[i] == '.' && scale == 0)
+    {
+      scale = 0.1;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  if (!digits)
+  {
+    return false;
+  }
+  out = negative ? -value : value;
+  return true;
+}
+
+bool spanEquals(const char *s, unsigned int length, const char *literal)
+{
+  return strlen(literal) == length && memcmp(s, literal, length) == 0;
+}
+
+#define MULTI_TEMP_IN (1 << 0)
+#define MULTI_TEMP_OUT (1 << 1)
+#define MULTI_HUM_OUT (1 << 2)
+#define MULTI_HEATING (1 << 3)
+#define MULTI_FORECAST_LOW (1 << 4)
+#define MULTI_FORECAST_HIGH (1 << 5)
+#define MULTI_POWER (1 << 6)
+#define MULTI_ENERGY (1 << 7)
+
+// values of one multi-value message, applied together once the whole message parsed
+struct MultiValues
+{
+  uint16_t present;
+  float tempIn;
+  float tempOut;
+  float humidityOut;
+  int heatingMode;
+  float forecastLow;
+  float forecastHigh;
+  float powerNow;
+  float energyToday;
+};
+
+bool multiNumber(MultiValues &values, uint16_t flag, float &field, const char *value, unsigned int valueLength)
+{
+  if (!parseNumber(value, valueLength, field))
+  {
+    return false;
+  }
+  values.present |= flag;
+  return true;
+}
+
+bool multiValue(MultiValues &values, const char *key, unsigned int keyLength, const char *value, unsigned int valueLength)
+{
+  if (spanEquals(key, keyLength, "in"))
+  {
+    return multiNumber(values, MULTI_TEMP_IN, values.tempIn, value, valueLength);
+  }
+  if (spanEquals(key, keyLength, "out"))
+  {
+    return multiNumber(values, MULTI_TEMP_OUT, values.tempOut, value, valueLength);
+  }
+  if (spanEquals(key, keyLength, "hum"))
+  {
+    return multiNumber(values, MULTI_HUM_OUT, values.humidityOut, value, valueLength);
+  }
+  if (spanEquals(key, keyLength, "fc_lo"))
+  {
+    return multiNumber(values, MULTI_FORECAST_LOW, values.forecastLow, value, valueLength);
+  }
+  if (spanEquals(key, keyLength, "fc_hi"))
+  {
+    return multiNumber(values, MULTI_FORECAST_HIGH, values.forecastHigh, value, valueLength);
+  }
+  if (spanEquals(key, keyLength, "power"))
+  {
+    return multiNumber(values, MULTI_POWER, values.powerNow, value, valueLength);
+  }
+  if (spanEquals(key, keyLength, "energy"))
+  {
+    return multiNumber(values, MULTI_ENERGY, values.energyToday, value, valueLength);
+  }
+  // "off"/"heat"/"cool" or 0/1/2
+  if (spanEquals(key, keyLength, "mode"))
+  {
+    if (spanEquals(value, valueLength, "heat") || spanEquals(value, valueLength, "1"))
+    {
+      values.heatingMode = 1;
+    }
+    else if (spanEquals(value, valueLength, "cool") || spanEquals(value, valueLength, "2"))
+    {
+      values.heatingMode = 2;
+    }
+    else
+    {
+      values.heatingMode = 0;
+    }
+    values.present |= MULTI_HEATING;
+  }
+  // unknown keys are ignored
+  return true;
+}
+
+bool isSeparator(char c)
+{
+  return c == ',' || c == ';' || c == '&' || c == '{' || c == '}' || c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// reads a quoted or bare token, returns the position behind it
+const char *scanToken(const char *p, const char *end, bool isKey, const char *&start, unsigned int &length)
+{
+  if (p < end && *p == '"')
+  {
+    start = ++p;
+    while (p < end && *p != '"')
+    {
+      p++;
+    }
+    length = p - start;
+    return p < end ? p + 1 : p;
+  }
+
+  start = p;
+  while (p < end && !isSeparator(*p) && !(isKey && (*p == ':' || *p == '=')))
+  {
+    p++;
+  }
+  length = p - start;
+  return p;
+}
+
+// Accepts a flat JSON object ({"in":21.5,"out":3.2,"mode":"heat","fc_lo":1,"fc_hi":7})
+// or key=value pairs (in=21.5;out=3.2;mode=heat). Works on the payload in place and
+// only applies the values if the whole message could be parsed.
+void onMulti(const byte *payload, unsigned int length)
+{
+  MultiValues values;
+  values.present = 0;
+
+  const char *p = (const char *)payload;
+  const char *end = p + length;
+  while (p < end)
+  {
+    if (isSeparator(*p))
+    {
+      p++;
+      continue;
+    }
+
+    const char *key;
+    unsigned int keyLength;
+    p = scanToken(p, end, true, key, keyLength);
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+      p++;
+    }
+    if (p >= end || (*p != ':' && *p != '='))
+    {
+      return;
+    }
+    p++;
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+      p++;
+    }
+
+    const char *value;
+    unsigned int valueLength;
+    p = scanToken(p, end, false, value, valueLength);
+    if (!multiValue(values, key, keyLength, value, valueLength))
+    {
+      return;
+    }
+  }
+
+  // all or nothing, the values are applied together by the next frame
+  int count = 0;
+  for (uint16_t bits = values.present; bits != 0; bits >>= 1)
+  {
+    count += bits & 1;
+  }
+  if (commandSpace() < (unsigned int)count)
+  {
+    commandsDropped++;
+    return;
+  }
+
+  if (values.present & MULTI_TEMP_IN)
+  {
+    postCommand(CMD_TEMP_IN, values.tempIn);
+  }
+  if (values.present & MULTI_TEMP_OUT)
+  {
+    postCommand(CMD_TEMP_OUT, values.tempOut);
+  }
+  if (values.present & MULTI_HEATING)
+  {
+    postCommand(CMD_HEATING, values.heatingMode);
+  }
+  if (values.present & MULTI_HUM_OUT)
+  {
+    postCommand(CMD_HUM_OUT, values.humidityOut);
+  }
+  if (values.present & MULTI_FORECAST_LOW)
+  {
+    postCommand(CMD_FORECAST_LOW, values.forecastLow);
+  }
+  if (values.present & MULTI_FORECAST_HIGH)
+  {
+    postCommand(CMD_FORECAST_HIGH, values.forecastHigh);
+  }
+  if (values.present & MULTI_POWER)
+  {
+    postCommand(CMD_POWER, values.powerNow);
+  }
+  if (values.present & MULTI_ENERGY)
+  {
+    postCommand(CMD_ENERGY, values.energyToday);
+  }
+}
+
+struct Route
+{
+  const char *topic;
+  void (*handler)(char *payload);
+  // part of the display state the broker should hold as retained message
+  bool state;
+  // gets the payload as is instead of a terminated copy
+  void (*rawHandler)(const byte *payload, unsigned int length);
+  // acts on the display itself: not traced, not replayed and also taken during a replay
+  bool control;
+  // topic without topDisplayPrefix, NULL if the topic is outside of it
+  const char *suffix;
+};
+
+#ifndef topBench
+#define topBench "home/sz/display/bench"
+#endif
+#ifndef topSnapshot
+#define topSnapshot "home/sz/display/snapshot"
+#endif
+
+// control handlers, defined next to what they start
+void onReplay(const byte *payload, unsigned int length);
+void onBench(const byte *payload, unsigned int length);
+void onSnapshot(const byte *payload, unsigned int length);
+
+Route routes[] = {
+    {topTempIn, onTempIn, true},
+    {topTempOut, onTempOut, true},
+    {topHeat, onHeat, true},
+    {topCool, onCool, true},
+    {topHumOut, onHumOut, true},
+    {topPower, onPower, true},
+    {topEnergyToday, onEnergyToday, true},
+    {topBright, onBright, false},
+    {topMinimalBright, onMinimalBright, false},
+    {topLightMeterDeb, onLightMeterDebug, false},
+    {topPage, onPage, false},
+    {topPageRotate, onPageRotate, false},
+    {topPageTransition, onPageTransition, false},
+    {topTheme, onTheme, false},
+    {topThemeDefine, onThemeDefine, false},
+    {topMulti, NULL, false, onMulti},
+    {topLayout, NULL, false, onLayout},
+    {topRefresh, onRefresh, false},
+    {topDither, onDither, false},
+    {topRollDigits, onRollDigits, false},
+    {topSparkline, onSparkline, false},
+    {topPowerBudget, onPowerBudget, false},
+    {topNightSchedule, onNightSchedule, false},
+    {topNightLux, onNightLux, false},
+    {topWake, onWake, false},
+    {topProfile, onProfile, false},
+    {topCapture, NULL, false, onCapture, true},
+    {topReplay, NULL, false, onReplay, true},
+    {topBench, NULL, false, onBench, true},
+    {topSnapshot, NULL, false, onSnapshot, true},
+};
+#define ROUTE_COUNT (sizeof(routes) / sizeof(routes[0]))
+
+// state routes seen since the last connect
+uint32_t populatedMask = 0;
+uint32_t populatedAll = 0;
+unsigned long mqttConnectedAt = 0;
+bool populatedReported = true;
+
+bool underPrefix(const char *topic)
+{
+  return strncmp(topic, topDisplayPrefix, PREFIX_LENGTH) == 0;
+}
+
+void initRoutes()
+{
+  for (unsigned int i = 0; i < ROUTE_COUNT; i++)
+  {
+    routes[i].suffix = underPrefix(routes[i].topic) ? routes[i].topic + PREFIX_LENGTH : NULL;
+    if (routes[i].state)
+    {
+      populatedAll |= 1UL << i;
+    }
+  }
+}
+
+// one pass over the table, topics below the prefix only compare their suffix
+const Route *findRoute(const char *topic)
+{
+  bool prefixed = underPrefix(topic);
+  const char *suffix = topic + PREFIX_LENGTH;
+  for (unsigned int i = 0; i < ROUTE_COUNT; i++)
+  {
+    if (routes[i].suffix != NULL)
+    {
+      if (prefixed && strcmp(suffix, routes[i].suffix) == 0)
+      {
+        return &routes[i];
+      }
+    }
+    else if (strcmp(topic, routes[i].topic) == 0)
+    {
+      return &routes[i];
+    }
+  }
+  return NULL;
+}
+
+void reportPopulated()
+{
+  int received = 0;
+  int expected = 0;
+  for (unsigned int i = 0; i < ROUTE_COUNT; i++)
+  {
+    if (populatedAll & (1UL << i))
+    {
+      expected++;
+      if (populatedMask & (1UL << i))
+      {
+        received++;
+      }
+    }
+  }
+
+  char report[64];
+  snprintf(report, sizeof(report), "{\"populated_ms\":%lu,\"received\":%d,\"expected\":%d}",
+           millis() - mqttConnectedAt, received, expected);
+  mqttPublish(topReconnectStats, report);
+  populatedReported = true;
+}
+
+void checkPopulated()
+{
+  if (!populatedReported && millis() - mqttConnectedAt > POPULATE_TIMEOUT_MS)
+  {
+    reportPopulated();
+  }
+}
+
+void mqttMessageReceived(char *topic, byte *payload, unsigned int length)
+{
+  const Route *route = findRoute(topic);
+  // a trace never holds control topics, this keeps a replay from starting another
+  if (route == NULL || route->control)
+  {
+    return;
+  }
+
+  if (route->rawHandler != NULL)
+  {
+    route->rawHandler(payload, length);
+  }
+  else
+  {
+    // the payload buffer has no room behind the last byte, handlers get a terminated copy
+    char value[64];
+    if (length >= sizeof(value))
+    {
+      return;
+    }
+    memcpy(value, payload, length);
+    value[length] = '\0';
+    route->handler(value);
+  }
+
+  if (route->state && !populatedReported)
+  {
+    populatedMask |= 1UL << (route - routes);
+    if (populatedMask == populatedAll)
+    {
+      reportPopulated();
+    }
+  }
+}
+
+// Everything a replayed message can change, taken when the replay starts and put back
+// when it ends, so a replay leaves the display as it was. The layout is not copied, it
+// is loaded again from LAYOUT_FILE, which a replay does not write.
+struct ReplaySaved
+{
+  float tempIn;
+  float tempOut;
+  float humidityOut;
+  float forecastLow;
+  float forecastHigh;
+  float powerNow;
+  float energyToday;
+  int heatingMode;
+  float currentLight;
+  int brightnessFine;
+  int minimalBrightFine;
+  bool lightMeterDebug;
+  bool memDebug;
+  int pinnedPage;
+  unsigned long pageRotateMs;
+  int transitionType;
+  bool themeAuto;
+  const Theme *themeTarget;
+  Theme userThemes[USER_THEMES];
+  char userThemeNames[USER_THEMES][THEME_NAME_LEN];
+  bool layoutActive;
+  uint32_t refreshIntervalUs;
+  bool ditherEnabled;
+  bool rollDigits;
+  bool showSparkline;
+  uint32_t powerBudgetMa;
+  bool nightScheduleOn;
+  int nightStart;
+  int nightEnd;
+  int nightLuxMinutes;
+  bool profiling;
+};
+ReplaySaved replaySaved;
+
+void saveReplayState()
+{
+  ReplaySaved &r = replaySaved;
+  r.tempIn = tempIn;
+  r.tempOut = tempOut;
+  r.humidityOut = humidityOut;
+  r.forecastLow = forecastLow;
+  r.forecastHigh = forecastHigh;
+  r.powerNow = powerNow;
+  r.energyToday = energyToday;
+  r.heatingMode = heatingMode;
+  r.currentLight = currentLight;
+  // a running ramp is not resumed, its target is what the display was heading to
+  Tween *ramp = tweenFind(brightnessTween);
+  r.brightnessFine = ramp != NULL ? ramp->to : brightnessFine;
+  r.minimalBrightFine = minimalBrightFine;
+  r.lightMeterDebug = lightMeterDebug;
+  r.memDebug = memDebug;
+  r.pinnedPage = pinnedPage;
+  r.pageRotateMs = pageRotateMs;
+  r.transitionType = transitionType;
+  r.themeAuto = themeAuto;
+  r.themeTarget = themeTarget;
+  memcpy(r.userThemes, userThemes, sizeof(userThemes));
+  memcpy(r.userThemeNames, userThemeNames, sizeof(userThemeNames));
+  r.layoutActive = layoutActive;
+  r.refreshIntervalUs = refreshIntervalUs;
+  r.ditherEnabled = ditherEnabled;
+  r.rollDigits = rollDigits;
+  r.showSparkline = showSparkline;
+  r.powerBudgetMa = powerBudgetMa;
+  r.nightScheduleOn = nightScheduleOn;
+  r.nightStart = nightStart;
+  r.nightEnd = nightEnd;
+  r.nightLuxMinutes = nightLuxMinutes;
+  r.profiling = profiling;
+}
+
+void restoreReplayState()
+{
+  // commands the replay posted must not be applied on top of the restored values
+  drainCommands();
+
+  const ReplaySaved &r = replaySaved;
+  tempIn = r.tempIn;
+  tempOut = r.tempOut;
+  humidityOut = r.humidityOut;
+  forecastLow = r.forecastLow;
+  forecastHigh = r.forecastHigh;
+  powerNow = r.powerNow;
+  energyToday = r.energyToday;
+  heatingMode = r.heatingMode;
+  currentLight = r.currentLight;
+  minimalBrightFine = r.minimalBrightFine;
+  lightMeterDebug = r.lightMeterDebug;
+  memDebug = r.memDebug;
+  pinnedPage = r.pinnedPage;
+  pageRotateMs = r.pageRotateMs;
+  transitionType = r.transitionType;
+  memcpy(userThemes, r.userThemes, sizeof(userThemes));
+  memcpy(userThemeNames, r.userThemeNames, sizeof(userThemeNames));
+  themeAuto = r.themeAuto;
+  setTheme(r.themeTarget);
+  if (r.layoutActive)
+  {
+    loadLayout();
+  }
+  else
+  {
+    activateLayout(false);
+  }
+  if (r.refreshIntervalUs != refreshIntervalUs)
+  {
+    setRefreshInterval(r.refreshIntervalUs);
+  }
+  ditherEnabled = r.ditherEnabled;
+  rollDigits = r.rollDigits;
+  showSparkline = r.showSparkline;
+  sparkTheme = NULL;
+  powerBudgetMa = r.powerBudgetMa;
+  nightScheduleOn = r.nightScheduleOn;
+  nightStart = r.nightStart;
+  nightEnd = r.nightEnd;
+  nightLuxMinutes = r.nightLuxMinutes;
+  profiling = r.profiling;
+
+  tweenStop(brightnessTween);
+  applyBrightnessFine(r.brightnessFine);
+  updatePowerLimit();
+  markPagesDirty();
+}
+
+uint32_t traceReadVarint()
+{
+  uint32_t v = 0;
+  int shift = 0;
+  int b;
+  do
+  {
+    b = traceFile.read();
+    if (b < 0)
+    {
+      return 0;
+    }
+    v |= (uint32_t)(b & 0x7F) << shift;
+    shift += 7;
+  } while (b & 0x80);
+  return v;
+}
+
+void finishReplay()
+{
+  traceFile.close();
+  replaying = false;
+  restoreReplayState();
+
+  char stats[96];
+  snprintf(stats, sizeof(stats), "events=%lu total_us=%lu max_us=%lu renders=%lu render_max_us=%lu",
+           replayEvents, replayTotalUs, replayMaxUs, renderCount, renderMaxUs);
+  mqttPublish(topReplayStats, stats);
+
+  // back to the real time
+  taskTimeSync(TASK_DIRECT);
+}
+
+void replayReadHeader()
+{
+  int type = traceFile.read();
+  if (type < 0)
+  {
+    finishReplay();
+    return;
+  }
+  replayType = type;
+  replayTraceMs += traceReadVarint();
+}
+
+void replayDispatch()
+{
+  unsigned long start = micros();
+
+  if (replayType == TRACE_MQTT)
+  {
+    uint8_t topicLength = traceFile.read();
+    traceFile.read((uint8_t *)replayTopic, topicLength);
+    replayTopic[topicLength] = '\0';
+    uint32_t length = traceReadVarint();
+    if (length < sizeof(replayPayload))
+    {
+      traceFile.read(replayPayload, length);
+      mqttMessageReceived(replayTopic, replayPayload, length);
+    }
+    else
+    {
+      traceFile.seek(traceFile.position() + length);
+    }
+  }
+  else if (replayType == TRACE_LUX)
+  {
+    float lux;
+    traceFile.read((uint8_t *)&lux, sizeof(lux));
+    postCommand(CMD_LIGHT, lux);
+  }
+  else if (replayType == TRACE_TIMESYNC)
+  {
+    uint32_t epoch;
+    traceFile.read((uint8_t *)&epoch, sizeof(epoch));
+    halSetTime(epoch);
+  }
+
+  unsigned long elapsed = micros() - start;
+  replayEvents++;
+  replayTotalUs += elapsed;
+  if (elapsed > replayMaxUs)
+  {
+    replayMaxUs = elapsed;
+  }
+}
+
+void startReplay(float speed)
+{
+  stopCapture();
+  traceFile = halFsOpen(TRACE_FILE, "r");
+  if (!traceFile)
+  {
+    return;
+  }
+
+  saveReplayState();
+  replaying = true;
+  replaySpeed = speed;
+  replayStartMs = millis();
+  replayTraceMs = 0;
+  replayEvents = 0;
+  replayTotalUs = 0;
+  replayMaxUs = 0;
+  renderCount = 0;
+  renderTotalUs = 0;
+  renderMaxUs = 0;
+  replayReadHeader();
+}
+
+// replay speed factor, e.g. "10" replays ten times faster, "0" stops a running replay
+void onReplay(const byte *payload, unsigned int length)
+{
+  float speed = 0;
+  parseNumber((const char *)payload, length, speed);
+  if (replaying)
+  {
+    finishReplay();
+  }
+  if (speed > 0)
+  {
+    startReplay(speed);
+  }
+}
+
+void taskReplay(xTaskId id)
+{
+  StackProbe probe(id);
+  if (!replaying)
+  {
+    return;
+  }
+  int batch = 0;
+  while (replaying && batch < REPLAY_BATCH && (millis() - replayStartMs) * replaySpeed >= replayTraceMs)
+  {
+    replayDispatch();
+    replayReadHeader();
+    batch++;
+  }
+}
+
+#ifndef topBenchResult
+#define topBenchResult topOutPrefix "benchresult"
+#endif
+
+bool benchRequested = false;
+const GFXfont *benchFont;
+const char *benchTopic;
+const char *benchPayload;
+byte benchBuffer[16];
+
+// runs from loop(), not inside the callback
+void onBench(const byte *payload, unsigned int length)
+{
+  benchRequested = true;
+}
+
+uint32_t benchCycles(void (*fn)(), uint32_t iterations)
+{
+  uint32_t start = halCycles();
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    fn();
+  }
+  return halCycles() - start;
+}
+
+// one JSON line per benchmark so results can be collected and compared across builds
+void benchReport(const char *name, uint32_t iterations, uint32_t cycles)
+{
+  uint32_t cyclesPerOp = cycles / iterations;
+  uint32_t nsPerOp = cyclesPerOp * 1000 / halCpuMhz();
+  char line[112];
+  snprintf(line, sizeof(line), "{\"build\":\"%s %s\",\"bench\":\"%s\",\"iter\":%u,\"ns_op\":%u,\"cycles_op\":%u}",
+           __DATE__, __TIME__, name, iterations, nsPerOp, cyclesPerOp);
+  mqttPublish(topBenchResult, line);
+  yield();
+}
+
+void benchGlyph(const char *name, const GFXfont *font)
+{
+  benchFont = font;
+  benchReport(name, 100, benchCycles([]() {
+    Adafruit_GFX &gfx = *pageCanvas[PAGE_ENERGY];
+    gfx.setFont(benchFont);
+    gfx.setCursor(10, 20);
+    gfx.write('8');
+  }, 100));
+}
+
+// the handler only posts a command, it is timed together with applying it so the
+// queue never fills up
+void benchMqtt(const char *name, const char *topic, const char *payload)
+{
+  benchTopic = topic;
+  benchPayload = payload;
+  benchReport(name, 100, benchCycles([]() {
+    unsigned int length = strlen(benchPayload);
+    memcpy(benchBuffer, benchPayload, length);
+    mqttMessageReceived((char *)benchTopic, benchBuffer, length);
+    drainCommands();
+  }, 100));
+}
+
+void runBenchmarks()
+{
+  benchRequested = false;
+  // the rendering benchmarks draw into the canvases
+  if (pageCanvas[PAGE_CLOCK] == NULL)
+  {
+    return;
+  }
+
+  // the parse benchmarks overwrite the current values, pending updates are applied
+  // first so they are part of what is restored
+  drainCommands();
+  float savedTempIn = tempIn;
+  float savedTempOut = tempOut;
+  int savedHeatingMode = heatingMode;
+
+  benchReport("clock_frame", 10, benchCycles([]() {
+    renderClockPage(*pageCanvas[PAGE_CLOCK]);
+    blitPage(PAGE_CLOCK);
+  }, 10));
+  // worst case: all four digits roll, usually only the last one does
+  uint8_t benchFrom[4] = {1, 9, 5, 9};
+  uint8_t benchTo[4] = {2, 0, 0, 0};
+  memcpy(rollFrom, benchFrom, 4);
+  memcpy(rollTo, benchTo, 4);
+  rollMask = 0x08;
+  benchReport("roll_frame_1digit", 100, benchCycles([]() { drawRollFrame(ROLL_FRAMES / 2); }, 100));
+  rollMask = 0x0F;
+  benchReport("roll_frame_4digits", 100, benchCycles([]() { drawRollFrame(ROLL_FRAMES / 2); }, 100));
+  rollMask = 0;
+  rollFrame = -1;
+  // the interpreter against the hard-coded face, both into a spare canvas
+  layoutDecode(layoutBuiltin, sizeof(layoutBuiltin), layoutDecoded);
+  benchReport("render_builtin", 10, benchCycles([]() { renderClockPage(*pageCanvas[PAGE_ENERGY]); }, 10));
+  benchReport("render_layout_full", 10, benchCycles([]() {
+    layoutDecoded.theme = NULL;
+    renderLayout(*pageCanvas[PAGE_ENERGY], layoutDecoded);
+  }, 10));
+  benchReport("render_layout_unchanged", 100, benchCycles([]() { renderLayout(*pageCanvas[PAGE_ENERGY], layoutDecoded); }, 100));
+  benchReport("spark_full", 10, benchCycles([]() { drawSparkline(*pageCanvas[PAGE_ENERGY]); }, 10));
+  sparkTheme = NULL;
+  benchReport("tween_update", 100, benchCycles([]() { updateTweens(schedClock()); }, 100));
+  benchReport("colon_step", 100, benchCycles([]() { taskColonBlink(TASK_DIRECT); }, 100));
+
+  benchGlyph("glyph_freesans12", &FreeSans12pt7b);
+  benchGlyph("glyph_lato9", &Lato_Hairline_9);
+  benchGlyph("glyph_tomthumb", &TomThumb);
+
+  benchMqtt("mqtt_tempin", topTempIn, "21.5");
+  benchMqtt("mqtt_tempout", topTempOut, "-3.2");
+  benchMqtt("mqtt_heat", topHeat, "1");
+  benchMqtt("mqtt_cool", topCool, "Off");
+  benchMqtt("mqtt_unknown", "home/sz/display/unknown", "1");
+
+  benchReport("brightness", 1000, benchCycles([]() {
+    volatile int b = brightnessForLight(currentLight);
+    (void)b;
+  }, 1000));
+
+  tempIn = savedTempIn;
+  tempOut = savedTempOut;
+  heatingMode = savedHeatingMode;
+  publishModel();
+  layout.theme = NULL;
+  markPagesDirty();
+  frameDirty = true;
+}
+
+#ifndef topSnapshotImage
+#define topSnapshotImage topOutPrefix "snapshotimage"
+#endif
+#ifndef HTTP_PORT
+#define HTTP_PORT 80
+#endif
+
+// Snapshots are QOI images (qoiformat.org) of panelShadow, the frame on the panel with
+// the colon, rolling digits, overlay and a running transition. The encoder works row
+// by row straight from the buffer and only reads it, the refresh keeps running while a
+// snapshot is sent.
+bool snapshotRequested = false;
+HalServer httpServer(HTTP_PORT);
+
+void onSnapshot(const byte *payload, unsigned int length)
+{
+  snapshotRequested = true;
+}
+
+// counts the bytes of a snapshot, MQTT needs the length before the payload
+class ByteCounter : public Print
+{
+public:
+  size_t count = 0;
+  size_t write(uint8_t) override
+  {
+    count++;
+    return 1;
+  }
+  size_t write(const uint8_t *buffer, size_t size) override
+  {
+    count += size;
+    return size;
+  }
+};
+
+struct QoiEncoder
+{
+  uint32_t index[64];
+  uint32_t prev;
+  int run;
+  // worst case is one 4 byte RGB op per pixel plus a pending run
+  uint8_t row[64 * 4 + 1];
+  int length;
+
+  void begin(Print &out, int width, int height)
+  {
+    memset(index, 0, sizeof(index));
+    prev = 0xFF000000;
+    run = 0;
+    uint8_t header[14] = {'q', 'o', 'i', 'f', 0, 0, 0, (uint8_t)width, 0, 0, 0, (uint8_t)height, 3, 0};
+    out.write(header, sizeof(header));
+  }
+
+  void put(uint8_t b)
+  {
+    row[length++] = b;
+  }
+
+  void pixel(uint16_t color, bool last)
+  {
+    uint8_t r = (color >> 11) & 0x1F;
+    uint8_t g = (color >> 5) & 0x3F;
+    uint8_t b = color & 0x1F;
+    r = (r << 3) | (r >> 2);
+    g = (g << 2) | (g >> 4);
+    b = (b << 3) | (b >> 2);
+    uint32_t px = 0xFF000000 | (r << 16) | (g << 8) | b;
+
+    if (px == prev)
+    {
+      run++;
+      if (run == 62 || last)
+      {
+        put(0xC0 | (run - 1));
+        run = 0;
+      }
+      return;
+    }
+    if (run > 0)
+    {
+      put(0xC0 | (run - 1));
+      run = 0;
+    }
+
+    int hash = (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+    if (index[hash] == px)
+    {
+      put(hash);
+    }
+    else
+    {
+      index[hash] = px;
+      int8_t dr = r - ((prev >> 16) & 0xFF);
+      int8_t dg = g - ((prev >> 8) & 0xFF);
+      int8_t db = b - (prev & 0xFF);
+      int8_t drg = dr - dg;
+      int8_t dbg = db - dg;
+      if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+      {
+        put(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+      }
+      else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7)
+      {
+        put(0x80 | (dg + 32));
+        put((drg + 8) << 4 | (dbg + 8));
+      }
+      else
+      {
+        put(0xFE);
+        put(r);
+        put(g);
+        put(b);
+      }
+    }
+    prev = px;
+  }
+
+  void encodeRow(Print &out, const uint16_t *pixels, int width, bool lastRow)
+  {
+    length = 0;
+    for (int x = 0; x < width; x++)
+    {
+      pixel(pixels[x], lastRow && x == width - 1);
+    }
+    out.write(row, length);
+  }
+
+  void end(Print &out)
+  {
+    static const uint8_t padding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    out.write(padding, sizeof(padding));
+  }
+};
+
+QoiEncoder snapshotEncoder;
+
+// only reads the panel shadow, encoding it twice between two frames gives the same bytes
+void writeSnapshot(Print &out)
+{
+  snapshotEncoder.begin(out, 64, 32);
+  for (int y = 0; y < 32; y++)
+  {
+    snapshotEncoder.encodeRow(out, panelShadow + y * 64, 64, y == 31);
+    yield();
+  }
+  snapshotEncoder.end(out);
+}
+
+size_t snapshotLength()
+{
+  ByteCounter counter;
+  writeSnapshot(counter);
+  return counter.count;
+}
+
+uint8_t heatmapHottest()
+{
+  uint8_t hottest = 1;
+  for (int i = 0; i < 64 * 32; i++)
+  {
+    hottest = std::max(hottest, profHeat[i]);
+  }
+  return hottest;
+}
+
+// writes per pixel of the profiler scaled to the hottest, black over red and yellow to white
+void heatmapRow(int y, uint8_t hottest, uint16_t *row)
+{
+  for (int x = 0; x < 64; x++)
+  {
+    int v = profHeat[y * 64 + x] * 765 / hottest;
+    int r = std::min(v, 255);
+    int g = std::min(std::max(v - 255, 0), 255);
+    int b = std::max(v - 510, 0);
+    row[x] = (r >> 3) << 11 | (g >> 2) << 5 | b >> 3;
+  }
+}
+
+void publishSnapshot()
+{
+  snapshotRequested = false;
+  size_t length = snapshotLength();
+  if (!mqttClient.beginPublish(topSnapshotImage, length, false))
+  {
+    return;
+  }
+  writeSnapshot(mqttClient);
+  if (mqttClient.endPublish())
+  {
+    publishCount++;
+    publishBytes += strlen(topSnapshotImage) + length;
+  }
+}
+
+// HTTP API next to MQTT for integrations that do not speak it:
+//   GET /values                   current values as JSON
+//   GET /stats                    render, refresh, MQTT and HTTP timing as JSON
+//   GET /control?bright=40&debug=1&theme=night
+//                                 any of the parameters, same payloads as the MQTT topics
+//   GET /snapshot                 visible frame as image/qoi
+//   GET /heatmap                  profiler heatmap as image/qoi
+// Nothing blocks: requests are read as they arrive and responses are written as far as
+// the socket takes them, from a static buffer per connection or a string constant.
+// Images are encoded row by row while being sent, a page redrawn meanwhile can tear.
+#define HTTP_CLIENTS 2
+#define HTTP_REQUEST_MAX 96
+#define HTTP_RESPONSE_MAX 384
+// time loop() spends on HTTP per pass
+#define HTTP_BUDGET_US 2000
+// request line and headers have to arrive within this time
+#define HTTP_REQUEST_TIMEOUT_MS 2000
+// a connection closes once the response is acknowledged, at the latest after this time
+#define HTTP_LINGER_MS 50
+// longest encoded row plus the end marker
+#define HTTP_IMAGE_CHUNK (64 * 4 + 1 + 8)
+#define HTTP_IDLE 0
+#define HTTP_READING 1
+#define HTTP_WRITING 2
+#define HTTP_IMAGE 3
+#define HTTP_CLOSING 4
+
+struct HttpConn
+{
+  HalClient client;
+  uint8_t state;
+  unsigned long since;
+  unsigned long acceptedUs;
+  // request line, the headers are skipped
+  char request[HTTP_REQUEST_MAX];
+  uint8_t length;
+  bool lineDone;
+  // last four bytes received, the headers end with an empty line
+  uint32_t tail;
+  const char *out;
+  size_t outLength;
+  size_t sent;
+  // holds httpEncoder, next row or -1 before the image header
+  bool image;
+  bool heatmap;
+  uint8_t hottest;
+  int imageRow;
+  char response[HTTP_RESPONSE_MAX];
+};
+
+const char httpNotFound[] = "HTTP/1.1 404 Not Found\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+const char httpBadRequest[] = "HTTP/1.1 400 Bad Request\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+const char httpBusy[] = "HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+const char httpNoContent[] = "HTTP/1.1 204 No Content\r\nConnection: close\r\n\r\n";
+// the close ends the body
+const char httpImage[] = "HTTP/1.1 200 OK\r\nContent-Type: image/qoi\r\nConnection: close\r\n\r\n";
+
+HttpConn httpConns[HTTP_CLIENTS];
+// one image at a time, the MQTT snapshot has its own encoder
+QoiEncoder httpEncoder;
+bool httpEncoderBusy = false;
+uint32_t httpRequests = 0;
+// connections refused while all slots were busy
+uint32_t httpRefused = 0;
+uint32_t httpPassMaxUs = 0;
+// from the accept to the last byte written
+uint32_t httpLatencyMaxUs = 0;
+
+void httpSend(HttpConn &c, const char *out, size_t length)
+{
+  c.out = out;
+  c.outLength = length;
+  c.sent = 0;
+  c.state = HTTP_WRITING;
+}
+
+void httpSendJson(HttpConn &c, const char *body)
+{
+  int len = snprintf(c.response, sizeof(c.response),
+                     "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nConnection: close\r\nContent-Length: %u\r\n\r\n%s",
+                     (unsigned)strlen(body), body);
+  if (len >= (int)sizeof(c.response))
+  {
+    httpSend(c, httpBusy, sizeof(httpBusy) - 1);
+    return;
+  }
+  httpSend(c, c.response, len);
+}
+
+void httpValues(HttpConn &c)
+{
+  char body[160];
+  snprintf(body, sizeof(body), "{\"temp_in\":%.1f,\"temp_out\":%.1f,\"heating\":%d,\"brightness\":%d,\"lux\":%.1f}",
+           tempIn, tempOut, heatingMode, std::min(brightness, brightnessLimit), currentLight);
+  httpSendJson(c, body);
+}
+
+void httpStats(HttpConn &c)
+{
+  char body[288];
+  snprintf(body, sizeof(body),
+           "{\"render_count\":%lu,\"render_avg_us\":%lu,\"render_max_us\":%lu,\"refresh_interval_us\":%u,"
+           "\"refresh_isr_max_us\":%u,\"refresh_jitter_max_us\":%u,\"mqtt_loop_max_us\":%u,\"http_requests\":%u,"
+           "\"http_refused\":%u,\"http_pass_max_us\":%u,\"http_latency_max_us\":%u}",
+           renderCount, renderCount > 0 ? renderTotalUs / renderCount : 0, renderMaxUs, refreshIntervalUs,
+           refreshIsrMaxUs, refreshJitterMaxUs, mqttLoopMaxUs, httpRequests, httpRefused, httpPassMaxUs, httpLatencyMaxUs);
+  httpSendJson(c, body);
+}
+
+// the query is split in place, every parameter is checked before any is applied
+void httpControl(HttpConn &c, char *query)
+{
+  char *values[3] = {NULL, NULL, NULL};
+  const char *keys[3] = {"bright", "debug", "theme"};
+  for (char *param = strtok(query, "&"); param != NULL; param = strtok(NULL, "&"))
+  {
+    char *value = strchr(param, '=');
+    int i = 0;
+    if (value != NULL)
+    {
+      *value++ = '\0';
+      while (i < 3 && strcmp(param, keys[i]) != 0)
+      {
+        i++;
+      }
+    }
+    if (value == NULL || i == 3)
+    {
+      httpSend(c, httpBadRequest, sizeof(httpBadRequest) - 1);
+      return;
+    }
+    values[i] = value;
+  }
+
+  if (values[0] != NULL)
+  {
+    onBright(values[0]);
+  }
+  if (values[1] != NULL)
+  {
+    onLightMeterDebug(values[1]);
+  }
+  if (values[2] != NULL)
+  {
+    onTheme(values[2]);
+  }
+  httpSend(c, httpNoContent, sizeof(httpNoContent) - 1);
+}
+
+void httpImageStart(HttpConn &c, bool heatmap)
+{
+  // the heatmap exists once the profiler was switched on
+  if (heatmap && profHeat == NULL)
+  {
+    httpSend(c, httpNotFound, sizeof(httpNotFound) - 1);
+    return;
+  }
+  if (httpEncoderBusy)
+  {
+    httpSend(c, httpBusy, sizeof(httpBusy) - 1);
+    return;
+  }
+  httpEncoderBusy = true;
+  c.image = true;
+  c.heatmap = heatmap;
+  c.hottest = heatmap ? heatmapHottest() : 0;
+  c.imageRow = -1;
+  httpSend(c, httpImage, sizeof(httpImage) - 1);
+}
+
+void httpHandle(HttpConn &c)
+{
+  httpRequests++;
+  char *target = c.request + 4;
+  char *end = strchr(target, ' ');
+  if (strncmp(c.request, "GET ", 4) != 0 || end == NULL)
+  {
+    httpSend(c, httpBadRequest, sizeof(httpBadRequest) - 1);
+    return;
+  }
+  *end = '\0';
+  char *query = strchr(target, '?');
+  if (query != NULL)
+  {
+    *query++ = '\0';
+  }
+
+  if (strcmp(target, "/values") == 0)
+  {
+    httpValues(c);
+  }
+  else if (strcmp(target, "/stats") == 0)
+  {
+    httpStats(c);
+  }
+  else if (strcmp(target, "/control") == 0 && query != NULL)
+  {
+    httpControl(c, query);
+  }
+  else if (strcmp(target, "/snapshot") == 0 || strcmp(target, "/heatmap") == 0)
+  {
+    httpImageStart(c, target[1] == 'h');
+  }
+  else
+  {
+    httpSend(c, httpNotFound, sizeof(httpNotFound) - 1);
+  }
+}
+
+void httpClose(HttpConn &c)
+{
+  if (c.image)
+  {
+    c.image = false;
+    httpEncoderBusy = false;
+  }
+  halClientClose(c.client);
+  c.state = HTTP_IDLE;
+}
+
+void httpFinish(HttpConn &c)
+{
+  uint32_t latency = micros() - c.acceptedUs;
+  if (latency > httpLatencyMaxUs)
+  {
+    httpLatencyMaxUs = latency;
+  }
+  c.state = HTTP_CLOSING;
+  c.since = millis();
+}
+
+// one bounded step of a connection, false if it had to wait for the network
+bool httpStep(HttpConn &c)
+{
+  switch (c.state)
+  {
+  case HTTP_READING:
+  {
+    int available = c.client.available();
+    if (available <= 0)
+    {
+      if (!c.client.connected() || millis() - c.since > HTTP_REQUEST_TIMEOUT_MS)
+      {
+        httpClose(c);
+      }
+      return false;
+    }
+    uint8_t buffer[64];
+    int n = c.client.read(buffer, std::min(available, (int)sizeof(buffer)));
+    for (int i = 0; i < n; i++)
+    {
+      c.tail = c.tail << 8 | buffer[i];
+      if (buffer[i] == '\n')
+      {
+        c.lineDone = true;
+      }
+      else if (!c.lineDone && buffer[i] != '\r' && c.length < HTTP_REQUEST_MAX - 1)
+      {
+        c.request[c.length++] = buffer[i];
+        c.request[c.length] = '\0';
+      }
+      if (c.tail == 0x0D0A0D0A)
+      {
+        httpHandle(c);
+        break;
+      }
+    }
+    return true;
+  }
+  case HTTP_WRITING:
+  {
+    size_t room = halClientWritable(c.client);
+    if (room == 0)
+    {
+      if (!c.client.connected())
+      {
+        httpClose(c);
+      }
+      return false;
+    }
+    c.sent += c.client.write((const uint8_t *)c.out + c.sent, std::min(room, c.outLength - c.sent));
+    if (c.sent == c.outLength)
+    {
+      if (c.image)
+      {
+        c.state = HTTP_IMAGE;
+      }
+      else
+      {
+        httpFinish(c);
+      }
+    }
+    return true;
+  }
+  case HTTP_IMAGE:
+  {
+    if (halClientWritable(c.client) < HTTP_IMAGE_CHUNK)
+    {
+      if (!c.client.connected())
+      {
+        httpClose(c);
+      }
+      return false;
+    }
+    if (c.imageRow < 0)
+    {
+      httpEncoder.begin(c.client, 64, 32);
+      c.imageRow = 0;
+      return true;
+    }
+    uint16_t row[64];
+    const uint16_t *pixels = row;
+    if (c.heatmap)
+    {
+      heatmapRow(c.imageRow, c.hottest, row);
+    }
+    else
+    {
+      pixels = panelShadow + c.imageRow * 64;
+    }
+    httpEncoder.encodeRow(c.client, pixels, 64, c.imageRow == 31);
+    if (++c.imageRow == 32)
+    {
+      httpEncoder.end(c.client);
+      c.image = false;
+      httpEncoderBusy = false;
+      httpFinish(c);
+    }
+    return true;
+  }
+  case HTTP_CLOSING:
+    if (halClientAcked(c.client) || millis() - c.since >= HTTP_LINGER_MS)
+    {
+      httpClose(c);
+      return true;
+    }
+    return false;
+  }
+  return false;
+}
+
+// called from every loop pass, steps the connections until they wait or the budget is used
+void serveHttp()
+{
+  unsigned long start = micros();
+
+  HalClient client = httpServer.available();
+  if (client)
+  {
+    HttpConn *c = NULL;
+    for (int i = 0; i < HTTP_CLIENTS && c == NULL; i++)
+    {
+      if (httpConns[i].state == HTTP_IDLE)
+      {
+        c = &httpConns[i];
+      }
+    }
+    if (c == NULL)
+    {
+      httpRefused++;
+      halClientClose(client);
+    }
+    else
+    {
+      c->client = client;
+      c->state = HTTP_READING;
+      c->since = millis();
+      c->acceptedUs = start;
+      c->length = 0;
+      c->request[0] = '\0';
+      c->lineDone = false;
+      c->tail = 0;
+    }
+  }
+
+  bool progress = true;
+  while (progress && micros() - start < HTTP_BUDGET_US)
+  {
+    progress = false;
+    for (int i = 0; i < HTTP_CLIENTS; i++)
+    {
+      if (httpConns[i].state != HTTP_IDLE && httpStep(httpConns[i]))
+      {
+        progress = true;
+      }
+    }
+  }
+
+  uint32_t elapsed = micros() - start;
+  if (elapsed > httpPassMaxUs)
+  {
+    httpPassMaxUs = elapsed;
+  }
+}
+
+void mqttCallback(char *topic, byte *payload, unsigned int length)
+{
+  RenderLock lock;
+  const Route *route = findRoute(topic);
+  if (route == NULL)
+  {
+    return;
+  }
+  if (route->control)
+  {
+    route->rawHandler(payload, length);
+    return;
+  }
+
+  // live messages would mix with the replayed ones, unknown topics are not traced
+  if (replaying)
+  {
+    return;
+  }
+
+  traceMqtt(topic, payload, length);
+  mqttMessageReceived(topic, payload, length);
+}
+
+// called from every loop pass, sends a few entries at a time so mqttClient.loop()
+// and the tasks keep running while a long outage is caught up
+void flushOutbox()
+{
+  static unsigned long lastFlush = 0;
+  if (outboxCount == 0 || !mqttClient.connected() || millis() - lastFlush < OUTBOX_FLUSH_MS)
+  {
+    return;
+  }
+  lastFlush = millis();
+
+  for (int i = 0; i < OUTBOX_BATCH && outboxCount > 0; i++)
+  {
+    OutboxEntry &entry = outbox[outboxHead];
+    unsigned long age = millis() - entry.queuedAt;
+    // the time may only be known since the reconnect
+    unsigned long ts = timeValid() ? halTime() - age / 1000 : 0;
+    char message[160];
+    snprintf(message, sizeof(message), "{\"topic\":\"%s\",\"ts\":%lu,\"age_ms\":%lu,\"payload\":\"%s\"}",
+             entry.topic, ts, age, entry.payload);
+    if (!mqttClient.publish(topOutbox, message))
+    {
+      return;
+    }
+    publishCount++;
+    publishBytes += strlen(topOutbox) + strlen(message);
+    outboxHead = (outboxHead + 1) % OUTBOX_SIZE;
+    outboxCount--;
+    outboxFlushed++;
+  }
+}
+
+void publishOutboxStats()
+{
+  char stats[112];
+  snprintf(stats, sizeof(stats), "{\"queued\":%u,\"flushed\":%u,\"dropped\":%u,\"skipped\":%u,\"pending\":%u}",
+           outboxQueued, outboxFlushed, outboxDropped, outboxSkipped, outboxCount);
+  mqttPublish(topOutboxStats, stats);
+}
+
+void publishMemStats()
+{
+  // one entry per task, too large for the stack
+  static char stats[512];
+  int len = snprintf(stats, sizeof(stats), "{\"heap\":%u,\"heap_min\":%u,\"block\":%u,\"frag\":%u,\"stack\":{",
+                     halFreeHeap(), minFreeHeap, halMaxFreeBlock(), halHeapFragmentation());
+  for (int i = 0; i < CTX_COUNT; i++)
+  {
+    if (ctxNames[i] != NULL && len < (int)sizeof(stats))
+    {
+      len += snprintf(stats + len, sizeof(stats) - len, "%s\"%s\":%u", i > 0 ? "," : "", ctxNames[i], stackHighWater[i]);
+    }
+  }
+  if (len < (int)sizeof(stats))
+  {
+    len += snprintf(stats + len, sizeof(stats) - len, "}}");
+  }
+  if (len >= (int)sizeof(stats))
+  {
+    return;
+  }
+  mqttPublishLarge(topMemStats, stats, len);
+}
+
+void taskMem(xTaskId id)
+{
+  StackProbe probe(id);
+  static int samples = 0;
+
+  uint32_t freeHeap = halFreeHeap();
+  if (freeHeap < minFreeHeap)
+  {
+    minFreeHeap = freeHeap;
+  }
+
+  if (memDebug)
+  {
+    snprintf(memDebugBuffer, sizeof(memDebugBuffer), "H%u F%u B%u", freeHeap, halHeapFragmentation(), halMaxFreeBlock());
+    pageDirty[PAGE_CLOCK] = true;
+  }
+
+  // sampled every second, published once a minute
+  if (++samples >= 60)
+  {
+    samples = 0;
+    publishMemStats();
+    publishSchedStats();
+    publishRefreshStats();
+    publishHistoryStats();
+    publishPower();
+    publishNightStats();
+    publishOutboxStats();
+    publishSyncStats();
+    publishProfileStats();
+    nightMaSum = 0;
+    nightMaSamples = 0;
+  }
+}
+
+#define MQTT_RETRY_MS 5000
+// a cached access point that does not answer within this time is dropped for a full scan
+#define WIFI_FAST_TIMEOUT_MS 3000
+
+unsigned long mqttLastAttempt = 0;
+bool wifiFastConnect = false;
+unsigned long wifiStartMs = 0;
+
+void publishBootTimes()
+{
+  char report[160];
+  int len = snprintf(report, sizeof(report), "{\"fast_wifi\":%d,\"canvases\":%d,\"heap\":%u",
+                     savedState.wifiChannel > 0 && wifiFastConnect, canvasCount, bootFreeHeap);
+  for (int i = 0; i < BOOT_PHASES && len < (int)sizeof(report); i++)
+  {
+    len += snprintf(report + len, sizeof(report) - len, ",\"%s\":%lu", bootPhaseNames[i], bootTimes[i]);
+  }
+  if (len < (int)sizeof(report))
+  {
+    snprintf(report + len, sizeof(report) - len, "}");
+    mqttPublish(topBootTime, report);
+  }
+  bootReported = true;
+}
+
+// one connection attempt, retried from loop() without blocking the display
+void startMqtt()
+{
+  if (mqttLastAttempt != 0 && millis() - mqttLastAttempt < MQTT_RETRY_MS)
+  {
+    return;
+  }
+  mqttLastAttempt = millis();
+
+  char clientId[16];
+  snprintf(clientId, sizeof(clientId), "iotdisplay-%lx", random(0xffff));
+  if (mqttClient.connect(clientId))
+  {
+    // everything below the prefix, retained values arrive as one burst
+    mqttClient.subscribe(topDisplayPrefix "#");
+    for (unsigned int i = 0; i < ROUTE_COUNT; i++)
+    {
+      if (routes[i].suffix == NULL)
+      {
+        mqttClient.subscribe(routes[i].topic);
+      }
+    }
+    populatedMask = 0;
+    populatedReported = false;
+    mqttConnectedAt = millis();
+
+    bootMark(BOOT_MQTT);
+    if (!bootReported)
+    {
+      publishBootTimes();
+    }
+  }
+}
+
+// starts the association and returns, checkWifi() follows up from loop()
+void startWifi(void)
+{
+  halWifiBegin(wifiAP, wifiPassword, savedState.wifiChannel, savedState.wifiBssid);
+  wifiFastConnect = savedState.wifiChannel > 0;
+  wifiStartMs = millis();
+}
+
+void checkWifi()
+{
+  if (halWifiConnected())
+  {
+    if (bootTimes[BOOT_WIFI] == 0)
+    {
+      bootMark(BOOT_WIFI);
+      int32_t channel = halWifiChannel();
+      if (channel != savedState.wifiChannel || memcmp(halWifiBssid(), savedState.wifiBssid, 6) != 0)
+      {
+        savedState.wifiChannel = channel;
+        memcpy(savedState.wifiBssid, halWifiBssid(), 6);
+        saveState(true);
+      }
+    }
+    return;
+  }
+
+  if (wifiFastConnect && millis() - wifiStartMs > WIFI_FAST_TIMEOUT_MS)
+  {
+    wifiFastConnect = false;
+    halWifiBegin(wifiAP, wifiPassword, 0, NULL);
+  }
+}
+
+// a frame of the render core, there is nothing to draw while the panel is blanked
+void renderFrame()
+{
+  if (nightBlanked)
+  {
+    return;
+  }
+  taskColonBlink(TASK_DIRECT);
+  taskPages(TASK_DIRECT);
+}
+
+void setup()
+{
+  halPanelBegin();
+  initDither();
+  initEasing();
+  startColonTween();
+  display_update_enable(true);
+
+  halFsBegin();
+  loadState();
+  loadHistory();
+  loadLayout();
+  publishModel();
+  bootMark(BOOT_STATE);
+  applyBrightness();
+
+  // the first frame is drawn right away from the restored values
+  initPageCanvases();
+  for (int i = 0; i < PAGE_COUNT; i++)
+  {
+    renderPage(i);
+    pageDirty[i] = false;
+  }
+  initDigitCache();
+  blitPage(currentPage);
+  frameDirty = false;
+  bootMark(BOOT_FIRST_FRAME);
+
+  mqttClient.setServer(mqtt_server, mqtt_port);
+  mqttClient.setCallback(mqttCallback);
+  initRoutes();
+  startWifi();
+  httpServer.begin();
+  xHeliOSSetup();
+  halOnTimeSync(timeSynced);
+  taskTimeSync(TASK_DIRECT);
+
+  BH1750Check = halLightBegin();
+
+  // priority and budget per task, the colon and page transitions have to stay smooth
+  // two seconds for the time
+  addTask("TASKCLOCK", &taskClock, 2 * 1000 * 1000, 2, 1000);
+
+  // 20 milliseconds for the colon and for page updates and transitions, on a core of their own if there is one
+  if (!halRenderBegin(renderFrame, 20 * 1000))
+  {
+    taskColId = addTask("TASKCOL", &taskColonBlink, 20 * 1000, 3, 2000);
+    taskPageId = addTask("TASKPAGE", &taskPages, 20 * 1000, 3, 8000);
+  }
+
+  // 20 milliseconds for replaying a captured trace
+  addTask("TASKREPLAY", &taskReplay, 20 * 1000, 2, 10000);
+
+  // five seconds for the sensor
+  addTask("TASKSENSOR", &taskSensor, 5 * 1000 * 1000, 1, 20000);
+
+  // five seconds for telemetry, published only on change or as heartbeat
+  addTask("TASKTELEMETRY", &taskTelemetry, 5 * 1000 * 1000, 0, 10000);
+
+  // one second for heap and stack sampling
+  addTask("TASKMEM", &taskMem, 1000 * 1000, 0, 10000);
+
+  // one minute for persisting the last known values
+  addTask("TASKSTATE", &taskState, 60ULL * 1000 * 1000, 0, 50000);
+
+  // one minute for the temperature history, sampled once per HISTORY_INTERVAL_S
+  addTask("TASKHISTORY", &taskHistory, 60ULL * 1000 * 1000, 0, 50000);
+
+  // one second for the night blanking schedule
+  addTask("TASKNIGHT", &taskNight, 1000 * 1000, 1, 20000);
+
+  // two seconds for the time beacon shared with the other displays
+  addTask("TASKSYNC", &taskSync, BEACON_INTERVAL_MS * 1000UL, 1, 5000);
+
+  // four hours for the timesync
+  addTask("TASKTIMESYNC", &taskTimeSync, 4ULL * 60 * 60 * 1000 * 1000, 0, 5000);
+
+  // the dispatcher runs on every HeliOS loop
+  xTaskId id = xTaskAdd("TASKSCHED", &taskSched);
+  xTaskStart(id);
+  bootFreeHeap = halFreeHeap();
+}
+
+uint8_t icon_index = 0;
+// connecting and waiting for the broker do not hold off the render core, everything else does
+void loop()
+{
+  {
+    RenderLock lock;
+    xHeliOSLoop();
+    checkWifi();
+  }
+  if (halWifiConnected() && !mqttClient.connected())
+  {
+    startMqtt();
+  }
+  unsigned long mqttStart = micros();
+  mqttClient.loop();
+  unsigned long mqttElapsed = micros() - mqttStart;
+  if (mqttElapsed > mqttLoopMaxUs)
+  {
+    mqttLoopMaxUs = mqttElapsed;
+  }
+  if (mqttElapsed > MQTT_LOOP_BUDGET_US)
+  {
+    mqttLoopOverruns++;
+  }
+
+  {
+    RenderLock lock;
+    checkPopulated();
+    flushOutbox();
+    receiveBeacons();
+    if (powerReportDue)
+    {
+      powerReportDue = false;
+      publishPower();
+    }
+
+    if (benchRequested)
+    {
+      runBenchmarks();
+    }
+    if (snapshotRequested && mqttClient.connected())
+    {
+      publishSnapshot();
+    }
+    serveHttp();
+  }
+
+  // nothing to draw, the idle time lets the SDK sleep between beacons
+  if (nightBlanked)
+  {
+    delay(NIGHT_IDLE_MS);
+  }
+
+  // the deepest point of the whole pass, MQTT, HTTP and the snapshot included
+  stackNote(halLoopStackUsed());
 }
\ No newline at end of file
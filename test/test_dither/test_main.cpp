@@ -0,0 +1,133 @@
+// Brightness dithering on the host: the refresh ISR is called by hand, the panel
+// brightness of every simulated plane is recorded and averaged over frames.
+
+#include <unity.h>
+#include "../../src/main.cpp"
+
+// brightness of each display() call
+uint8_t planes[DITHER_PLANES * DITHER_STEPS];
+
+void setUp()
+{
+  display_update_enable(false);
+  ditherEnabled = true;
+}
+
+void tearDown()
+{
+}
+
+void simulate(int fine)
+{
+  applyBrightnessFine(fine);
+  refreshCalls = 0;
+  for (int i = 0; i < DITHER_PLANES * DITHER_STEPS; i++)
+  {
+    display_updater();
+    planes[i] = display.brightness;
+  }
+}
+
+// the average over all frames is the fine value, in quarters of a level
+void test_average_matches_fine()
+{
+  for (int fine = 0; fine < 255 * 16; fine++)
+  {
+    simulate(fine);
+    int sum = 0;
+    for (int i = 0; i < DITHER_PLANES * DITHER_STEPS; i++)
+    {
+      sum += planes[i];
+    }
+    TEST_ASSERT_EQUAL(((fine >> 4) * 4 + ((fine & 15) >> 2)) * DITHER_STEPS, sum);
+  }
+}
+
+// every frame is as bright as the next, each plane is raised equally often
+void test_no_slower_pattern()
+{
+  for (int fine = 0; fine < 16; fine++)
+  {
+    simulate(5 * 16 + fine);
+    int frame0 = 0;
+    for (int p = 0; p < DITHER_PLANES; p++)
+    {
+      frame0 += planes[p];
+    }
+    for (int f = 1; f < DITHER_STEPS; f++)
+    {
+      int frame = 0;
+      for (int p = 0; p < DITHER_PLANES; p++)
+      {
+        frame += planes[f * DITHER_PLANES + p];
+      }
+      TEST_ASSERT_EQUAL(frame0, frame);
+    }
+    for (int p = 1; p < DITHER_PLANES; p++)
+    {
+      int plane0 = 0;
+      int plane = 0;
+      for (int f = 0; f < DITHER_STEPS; f++)
+      {
+        plane0 += planes[f * DITHER_PLANES];
+        plane += planes[f * DITHER_PLANES + p];
+      }
+      TEST_ASSERT_EQUAL(plane0, plane);
+    }
+  }
+}
+
+// without light the face sits between two panel levels and is dithered
+void test_night_is_dithered()
+{
+  int fine = brightnessFineForLight(0);
+  TEST_ASSERT_NOT_EQUAL(0, fine & 15);
+  simulate(fine);
+  bool low = false;
+  bool high = false;
+  for (int i = 0; i < DITHER_PLANES * DITHER_STEPS; i++)
+  {
+    low |= planes[i] == fine >> 4;
+    high |= planes[i] == (fine >> 4) + 1;
+  }
+  TEST_ASSERT_TRUE(low && high);
+}
+
+// a dim night colour channel averaged over the frames keeps its level between the steps
+void test_night_colour_average()
+{
+  simulate(brightnessFineForLight(0));
+  // green of the night clock colour as the panel gets it
+  int green = (themeNight.clock >> 5) & 0x3F;
+  float sum = 0;
+  for (int i = 0; i < DITHER_PLANES * DITHER_STEPS; i++)
+  {
+    sum += green * planes[i] / 255.0f;
+  }
+  float average = sum / (DITHER_PLANES * DITHER_STEPS);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, green * brightnessFineForLight(0) / 16.0f / 255.0f, average);
+}
+
+void test_fractional_minimum()
+{
+  onMinimalBright((char *)"2.25");
+  TEST_ASSERT_EQUAL(36, brightnessFineForLight(0));
+  onMinimalBright((char *)"-1");
+  TEST_ASSERT_EQUAL(0, brightnessFineForLight(0));
+  onMinimalBright((char *)"3.5");
+}
+
+int main(int argc, char **argv)
+{
+  char root[] = "/tmp/test_ditherXXXXXX";
+  LittleFS.setRoot(mkdtemp(root));
+  setup();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_average_matches_fine);
+  RUN_TEST(test_no_slower_pattern);
+  RUN_TEST(test_night_is_dithered);
+  RUN_TEST(test_night_colour_average);
+  RUN_TEST(test_fractional_minimum);
+  return UNITY_END();
+}
@@ -0,0 +1,214 @@
+// HTTP load on the host: client threads request values, stats and snapshots over
+// loopback while loop() serves them and the simulated refresh runs. Every request gets
+// an answer and the latency is measured on the client side. With the clients in the
+// same thread no pass over the connections exceeds the budget by more than one step,
+// under threads the host may preempt a pass.
+
+#include <unity.h>
+#include "../../src/main.cpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <thread>
+#include <vector>
+
+#define LOAD_THREADS 4
+#define LOAD_REQUESTS 40
+// one step of a connection, an image row or a read of 64 bytes, on a slow host
+#define STEP_SLACK_US 2000
+
+std::atomic<int> running{0};
+std::atomic<int> answered{0};
+std::atomic<int> busy{0};
+std::atomic<int> failed{0};
+std::vector<uint32_t> latencies[LOAD_THREADS];
+
+// connected socket with the request sent, -1 if the connect failed
+int sendRequest(const char *target)
+{
+  int s = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(HTTP_PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(s, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+  {
+    close(s);
+    return -1;
+  }
+  char line[128];
+  int length = snprintf(line, sizeof(line), "GET %s HTTP/1.1\r\nHost: display\r\n\r\n", target);
+  send(s, line, length, MSG_NOSIGNAL);
+  return s;
+}
+
+// status code of the response, 0 if the server closed without one
+int request(const char *target, size_t &bodyLength)
+{
+  int s = sendRequest(target);
+  if (s < 0)
+  {
+    return -1;
+  }
+
+  struct timeval timeout = {5, 0};
+  setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  std::vector<char> response;
+  char buffer[1024];
+  ssize_t n;
+  while ((n = recv(s, buffer, sizeof(buffer), 0)) > 0)
+  {
+    response.insert(response.end(), buffer, buffer + n);
+  }
+  close(s);
+  if (n < 0 || response.size() < 12)
+  {
+    return 0;
+  }
+  const char *end = "\r\n\r\n";
+  auto body = std::search(response.begin(), response.end(), end, end + 4);
+  bodyLength = body == response.end() ? 0 : response.end() - body - 4;
+  return atoi(response.data() + 9);
+}
+
+void client(int id)
+{
+  const char *targets[] = {"/values", "/stats", "/snapshot", "/control?bright=40"};
+  for (int i = 0; i < LOAD_REQUESTS; i++)
+  {
+    const char *target = targets[(id + i) % 4];
+    auto start = std::chrono::steady_clock::now();
+    size_t bodyLength = 0;
+    int status;
+    // a connection refused while both slots are busy is closed without an answer
+    for (int attempt = 0; (status = request(target, bodyLength)) == 0 && attempt < 50; attempt++)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    latencies[id].push_back(us);
+    if (status == 503)
+    {
+      busy++;
+    }
+    else if ((status == 200 && bodyLength > 0) || status == 204)
+    {
+      answered++;
+    }
+    else
+    {
+      failed++;
+    }
+  }
+  running--;
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_load_with_refresh()
+{
+  display_update_enable(true);
+  httpPassMaxUs = 0;
+  httpLatencyMaxUs = 0;
+  uint32_t requestsBefore = httpRequests;
+  uint32_t refreshBefore = refreshCalls;
+
+  std::thread threads[LOAD_THREADS];
+  running = LOAD_THREADS;
+  for (int i = 0; i < LOAD_THREADS; i++)
+  {
+    threads[i] = std::thread(client, i);
+  }
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+  while (running > 0 && std::chrono::steady_clock::now() < deadline)
+  {
+    loop();
+  }
+  for (int i = 0; i < LOAD_THREADS; i++)
+  {
+    threads[i].join();
+  }
+  display_update_enable(false);
+  uint32_t refreshes = refreshCalls - refreshBefore;
+
+  std::vector<uint32_t> all;
+  for (int i = 0; i < LOAD_THREADS; i++)
+  {
+    all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+  }
+  std::sort(all.begin(), all.end());
+  printf("requests %d, busy %d, refused %u, latency median %u us, p99 %u us, max %u us, server max %u us, pass max %u us, %u refreshes\n",
+         (int)all.size(), (int)busy, httpRefused, all[all.size() / 2], all[all.size() * 99 / 100], all.back(),
+         httpLatencyMaxUs, httpPassMaxUs, refreshes);
+
+  TEST_ASSERT_GREATER_THAN(0, refreshes);
+  TEST_ASSERT_EQUAL(0, (int)failed);
+  TEST_ASSERT_EQUAL(LOAD_THREADS * LOAD_REQUESTS, answered + busy);
+  // only a second image while one is encoded is turned away
+  TEST_ASSERT_GREATER_THAN(LOAD_THREADS * LOAD_REQUESTS * 3 / 4, (int)answered);
+  TEST_ASSERT_GREATER_OR_EQUAL(answered + busy, httpRequests - requestsBefore);
+  // a close that waited for acknowledgements would show up here
+  TEST_ASSERT_LESS_THAN(HTTP_REQUEST_TIMEOUT_MS * 1000UL, all.back());
+}
+
+// both slots busy with images and more connections waiting, served from this thread
+void test_pass_within_budget()
+{
+  httpPassMaxUs = 0;
+  const char *targets[] = {"/snapshot", "/heatmap", "/stats", "/values"};
+  for (int round = 0; round < 50; round++)
+  {
+    int sockets[4];
+    for (int i = 0; i < 4; i++)
+    {
+      sockets[i] = sendRequest(targets[i]);
+      TEST_ASSERT_GREATER_OR_EQUAL(0, sockets[i]);
+      fcntl(sockets[i], F_SETFL, O_NONBLOCK);
+    }
+    int open = 4;
+    for (int pass = 0; pass < 5000 && open > 0; pass++)
+    {
+      serveHttp();
+      for (int i = 0; i < 4; i++)
+      {
+        char buffer[1024];
+        if (sockets[i] >= 0 && recv(sockets[i], buffer, sizeof(buffer), 0) == 0)
+        {
+          close(sockets[i]);
+          sockets[i] = -1;
+          open--;
+        }
+      }
+    }
+    for (int i = 0; i < 4; i++)
+    {
+      if (sockets[i] >= 0)
+      {
+        close(sockets[i]);
+      }
+    }
+  }
+  printf("pass max %u us\n", httpPassMaxUs);
+  TEST_ASSERT_LESS_OR_EQUAL(HTTP_BUDGET_US + STEP_SLACK_US, httpPassMaxUs);
+}
+
+int main(int argc, char **argv)
+{
+  char root[] = "/tmp/test_httpXXXXXX";
+  LittleFS.setRoot(mkdtemp(root));
+  setup();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_load_with_refresh);
+  RUN_TEST(test_pass_within_budget);
+  return UNITY_END();
+}
@@ -0,0 +1,186 @@
+// Display logic on the host: value routing, the command queue, brightness and the saved state.
+// The sketch is built into the test so its internals can be reached.
+
+#include <unity.h>
+#include "../../src/main.cpp"
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <thread>
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void receive(const char *topic, const char *payload)
+{
+  char t[128];
+  strcpy(t, topic);
+  mqttCallback(t, (byte *)payload, strlen(payload));
+}
+
+void test_blend_ends()
+{
+  uint16_t a = rgb565(255, 0, 0);
+  uint16_t b = rgb565(0, 0, 255);
+  TEST_ASSERT_EQUAL_HEX16(a, blend565(a, b, 0));
+  TEST_ASSERT_EQUAL_HEX16(b, blend565(a, b, 32));
+}
+
+void test_brightness_follows_light()
+{
+  int previous = brightnessFineForLight(0);
+  for (float lux = 1; lux < 200; lux += 7)
+  {
+    int fine = brightnessFineForLight(lux);
+    TEST_ASSERT_GREATER_OR_EQUAL(previous, fine);
+    previous = fine;
+  }
+  TEST_ASSERT_EQUAL(255 * 16, brightnessFineForLight(100000));
+}
+
+void test_value_reaches_model_at_frame_start()
+{
+  receive(topTempIn, "21.5");
+  TEST_ASSERT_EQUAL_FLOAT(0, tempIn);
+  drainCommands();
+  TEST_ASSERT_EQUAL_FLOAT(21.5, tempIn);
+  DisplayModel model;
+  TEST_ASSERT_TRUE(readModel(model));
+  TEST_ASSERT_EQUAL_FLOAT(21.5, model.tempIn);
+}
+
+void test_full_queue_drops()
+{
+  uint32_t dropped = commandsDropped;
+  for (int i = 0; i < COMMAND_QUEUE_SIZE; i++)
+  {
+    TEST_ASSERT_TRUE(postCommand(CMD_TEMP_OUT, i));
+  }
+  TEST_ASSERT_FALSE(postCommand(CMD_TEMP_OUT, -1));
+  TEST_ASSERT_EQUAL(dropped + 1, commandsDropped);
+  drainCommands();
+  TEST_ASSERT_EQUAL_FLOAT(COMMAND_QUEUE_SIZE - 1, tempOut);
+  TEST_ASSERT_EQUAL(COMMAND_QUEUE_SIZE, commandSpace());
+}
+
+void test_unknown_topic_ignored()
+{
+  receive(topDisplayPrefix "nosuchvalue", "1");
+  TEST_ASSERT_EQUAL(COMMAND_QUEUE_SIZE, commandSpace());
+}
+
+// control topics come from the route table, they act at once and are not traced
+void test_control_topics_routed()
+{
+  const char *controls[] = {topCapture, topReplay, topBench, topSnapshot};
+  for (const char *topic : controls)
+  {
+    const Route *route = findRoute(topic);
+    TEST_ASSERT_NOT_NULL(route);
+    TEST_ASSERT_TRUE(route->control);
+  }
+  snapshotRequested = false;
+  receive(topSnapshot, "1");
+  TEST_ASSERT_TRUE(snapshotRequested);
+  snapshotRequested = false;
+
+  receive(topCapture, "1");
+  TEST_ASSERT_TRUE(capturing);
+  receive(topBench, "1");
+  TEST_ASSERT_TRUE(benchRequested);
+  benchRequested = false;
+  receive(topCapture, "0");
+  TEST_ASSERT_FALSE(capturing);
+  HalFile trace = halFsOpen(TRACE_FILE, "r");
+  TEST_ASSERT_EQUAL(0, trace.size());
+  trace.close();
+}
+
+void test_state_survives_restart()
+{
+  tempIn = 19.25;
+  heatingMode = 2;
+  saveState(true);
+  tempIn = 0;
+  heatingMode = 0;
+  loadState();
+  TEST_ASSERT_EQUAL_FLOAT(19.25, tempIn);
+  TEST_ASSERT_EQUAL(2, heatingMode);
+}
+
+// a broker on loopback that accepts the connection and takes whatever is sent
+void brokerSession(int listener)
+{
+  int s = accept(listener, NULL, NULL);
+  uint8_t buffer[512];
+  recv(s, buffer, sizeof(buffer), 0);
+  uint8_t connack[4] = {0x20, 2, 0, 0};
+  send(s, connack, sizeof(connack), MSG_NOSIGNAL);
+  while (recv(s, buffer, sizeof(buffer), 0) > 0)
+  {
+  }
+  close(s);
+}
+
+// a publish the client refuses is queued, not counted
+void test_publish_counts_sent()
+{
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int on = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(mqtt_port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  TEST_ASSERT_EQUAL(0, bind(listener, (struct sockaddr *)&addr, sizeof(addr)));
+  listen(listener, 1);
+  std::thread broker(brokerSession, listener);
+  TEST_ASSERT_TRUE(mqttClient.connect("test"));
+
+  unsigned long count = publishCount;
+  unsigned long bytes = publishBytes;
+  TEST_ASSERT_TRUE(mqttPublish(topTempIn, "21.5"));
+  TEST_ASSERT_EQUAL(count + 1, publishCount);
+  TEST_ASSERT_EQUAL(bytes + strlen(topTempIn) + 4, publishBytes);
+
+  char large[MQTT_MAX_PACKET_SIZE + 1];
+  memset(large, '1', MQTT_MAX_PACKET_SIZE);
+  large[MQTT_MAX_PACKET_SIZE] = 0;
+  TEST_ASSERT_FALSE(mqttPublish(topTempIn, large));
+  TEST_ASSERT_EQUAL(count + 1, publishCount);
+  TEST_ASSERT_EQUAL(bytes + strlen(topTempIn) + 4, publishBytes);
+
+  // what went out from the outbox
+  outboxPush(topTempOut, "-3.2");
+  uint32_t flushed = outboxFlushed;
+  delay(OUTBOX_FLUSH_MS);
+  flushOutbox();
+  TEST_ASSERT_GREATER_THAN(flushed, outboxFlushed);
+  TEST_ASSERT_EQUAL(count + 1 + outboxFlushed - flushed, publishCount);
+
+  mqttClient.disconnect();
+  broker.join();
+  close(listener);
+}
+
+int main(int argc, char **argv)
+{
+  char root[] = "/tmp/test_logicXXXXXX";
+  LittleFS.setRoot(mkdtemp(root));
+  setup();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_blend_ends);
+  RUN_TEST(test_brightness_follows_light);
+  RUN_TEST(test_value_reaches_model_at_frame_start);
+  RUN_TEST(test_full_queue_drops);
+  RUN_TEST(test_unknown_topic_ignored);
+  RUN_TEST(test_control_topics_routed);
+  RUN_TEST(test_state_survives_restart);
+  RUN_TEST(test_publish_counts_sent);
+  return UNITY_END();
+}
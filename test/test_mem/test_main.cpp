@@ -0,0 +1,251 @@
+// Memory telemetry on the host: stack probes on the simulated stack keep the marks of
+// the loop and of enclosing tasks, the tracking allocator backs the heap counters and
+// shows that loop passes do not leak. With its limit the pages get by on one canvas
+// or none.
+
+#include <unity.h>
+#include "../../src/main.cpp"
+#include <vector>
+
+// the code runs at depth bytes and goes down to deepest, a repaint only covers what
+// lies below the current depth
+void useStack(uint32_t depth, uint32_t deepest)
+{
+  halNativeStackDepth = depth;
+  if (deepest > halNativeStackMark)
+  {
+    halNativeStackMark = deepest;
+  }
+}
+
+char *heldArray;
+
+void freePageCanvases()
+{
+  for (int i = 0; i < canvasCount; i++)
+  {
+    delete (ProfCanvas *)pageCanvas[i];
+  }
+  memset(pageCanvas, 0, sizeof(pageCanvas));
+  canvasCount = 0;
+}
+
+// the canvases again with the heap limited to room bytes more than in use
+void initCanvasesWithin(size_t room)
+{
+  freePageCanvases();
+  nativeHeapLimit(nativeHeapInUse() + room);
+  initPageCanvases();
+  nativeHeapLimit(0);
+}
+
+void restoreCanvases()
+{
+  pinnedPage = -1;
+  freePageCanvases();
+  initPageCanvases();
+  markPagesDirty();
+}
+
+void showPage(int page)
+{
+  pinnedPage = page;
+  taskPages(TASK_DIRECT);
+}
+
+void setUp()
+{
+  memset(stackHighWater, 0, sizeof(stackHighWater));
+  halNativeStackDepth = 0;
+  halNativeStackMark = 0;
+}
+
+void tearDown()
+{
+  halNativeStackDepth = 0;
+  halNativeStackMark = 0;
+}
+
+// the loop went deeper before the task than the task itself
+void test_task_keeps_loop_mark()
+{
+  useStack(200, 1500);
+  {
+    useStack(300, 300);
+    StackProbe probe(0);
+    useStack(300, 900);
+  }
+  useStack(200, 200);
+  stackNote(halLoopStackUsed());
+  TEST_ASSERT_EQUAL(1500, stackHighWater[CTX_LOOP]);
+  TEST_ASSERT_EQUAL(900, stackHighWater[CTX_TASKS]);
+}
+
+// a task called from another one does not take the mark of the outer task
+void test_nested_probes()
+{
+  {
+    useStack(300, 300);
+    StackProbe outer(1);
+    useStack(300, 1200);
+    {
+      useStack(400, 400);
+      StackProbe inner(2);
+      useStack(400, 700);
+    }
+    useStack(300, 300);
+  }
+  TEST_ASSERT_EQUAL(1200, stackHighWater[CTX_TASKS + 1]);
+  TEST_ASSERT_EQUAL(700, stackHighWater[CTX_TASKS + 2]);
+  TEST_ASSERT_EQUAL(1200, stackHighWater[CTX_LOOP]);
+  TEST_ASSERT_NULL(stackProbeActive);
+}
+
+// the inner task went deeper than anything the outer one did itself
+void test_inner_counts_for_outer()
+{
+  {
+    StackProbe outer(1);
+    useStack(300, 600);
+    {
+      StackProbe inner(2);
+      useStack(400, 1800);
+    }
+  }
+  TEST_ASSERT_EQUAL(1800, stackHighWater[CTX_TASKS + 1]);
+  TEST_ASSERT_EQUAL(1800, stackHighWater[CTX_TASKS + 2]);
+}
+
+// parts of the pass after the tasks count for the loop
+void test_loop_sampled_at_end()
+{
+  useStack(100, 100);
+  loop();
+  useStack(100, 2200);
+  halNativeStackDepth = 0;
+  loop();
+  TEST_ASSERT_EQUAL(2200, stackHighWater[CTX_LOOP]);
+}
+
+void test_heap_counts_allocations()
+{
+  uint32_t before = halFreeHeap();
+  void *block = malloc(4096);
+  TEST_ASSERT_NOT_NULL(block);
+  TEST_ASSERT_LESS_OR_EQUAL(before - 4096, halFreeHeap());
+  size_t blocks = nativeHeapBlocks();
+  // kept in a global, an unused new and delete pair may be left out by the compiler
+  heldArray = new char[1024];
+  TEST_ASSERT_EQUAL(blocks + 1, nativeHeapBlocks());
+  delete[] heldArray;
+  free(block);
+  TEST_ASSERT_EQUAL(before, halFreeHeap());
+  TEST_ASSERT_GREATER_OR_EQUAL(4096 + 1024, nativeHeapPeak());
+  TEST_ASSERT_GREATER_THAN(0, bootFreeHeap);
+
+  std::vector<uint8_t> held(20000);
+  taskMem(TASK_DIRECT);
+  TEST_ASSERT_LESS_OR_EQUAL(before - 20000, minFreeHeap);
+}
+
+// a steady loop ends every pass with the heap it started with
+void test_loop_does_not_leak()
+{
+  for (int i = 0; i < 200; i++)
+  {
+    loop();
+  }
+  size_t used = nativeHeapInUse();
+  size_t blocks = nativeHeapBlocks();
+  for (int i = 0; i < 1000; i++)
+  {
+    loop();
+    updateClock();
+    renderPage(PAGE_CLOCK);
+  }
+  TEST_ASSERT_EQUAL(blocks, nativeHeapBlocks());
+  TEST_ASSERT_EQUAL(used, nativeHeapInUse());
+}
+
+// room for one canvas: every switch draws the page into it, without a transition
+void test_short_heap_shares_canvas()
+{
+  initCanvasesWithin(64 * 32 * 2 + 1024);
+  TEST_ASSERT_TRUE(canvasShared);
+  TEST_ASSERT_EQUAL(1, canvasCount);
+  TEST_ASSERT_NOT_NULL(pageCanvas[PAGE_CLOCK]);
+  TEST_ASSERT_EQUAL_PTR(pageCanvas[PAGE_CLOCK], pageCanvas[PAGE_WEATHER]);
+  TEST_ASSERT_EQUAL_PTR(pageCanvas[PAGE_CLOCK], pageCanvas[PAGE_ENERGY]);
+
+  ProfCanvas expected;
+  int pages[] = {PAGE_WEATHER, PAGE_ENERGY, PAGE_CLOCK};
+  for (int page : pages)
+  {
+    showPage(page);
+    TEST_ASSERT_EQUAL(page, currentPage);
+    TEST_ASSERT_EQUAL(-1, transitionFrame);
+    sparkTheme = NULL;
+    expected.fillScreen(0);
+    if (page == PAGE_WEATHER)
+    {
+      renderWeatherPage(expected);
+    }
+    else if (page == PAGE_ENERGY)
+    {
+      renderEnergyPage(expected);
+    }
+    else
+    {
+      renderClockPage(expected);
+    }
+    TEST_ASSERT_EQUAL_MEMORY(expected.getBuffer(), pageCanvas[page]->getBuffer(), 64 * 32 * 2);
+  }
+  // the sparkline band is not shifted on a canvas holding another page
+  showPage(PAGE_ENERGY);
+  TEST_ASSERT_FALSE(shiftSparkline(1));
+
+  restoreCanvases();
+  TEST_ASSERT_FALSE(canvasShared);
+}
+
+// not even the buffer of one canvas: the loop keeps running and the panel stays as it is
+void test_no_heap_for_canvases()
+{
+  initCanvasesWithin(512);
+  TEST_ASSERT_TRUE(canvasShared);
+  TEST_ASSERT_EQUAL(0, canvasCount);
+  TEST_ASSERT_NULL(pageCanvas[PAGE_CLOCK]);
+
+  markPagesDirty();
+  showPage(PAGE_WEATHER);
+  TEST_ASSERT_EQUAL(PAGE_WEATHER, currentPage);
+  showPage(PAGE_CLOCK);
+  for (int i = 0; i < 100; i++)
+  {
+    loop();
+  }
+  nightWake();
+  TEST_ASSERT_FALSE(shiftSparkline(1));
+  runBenchmarks();
+
+  restoreCanvases();
+  TEST_ASSERT_EQUAL(PAGE_COUNT, canvasCount);
+}
+
+int main(int argc, char **argv)
+{
+  char root[] = "/tmp/test_memXXXXXX";
+  LittleFS.setRoot(mkdtemp(root));
+  setup();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_task_keeps_loop_mark);
+  RUN_TEST(test_nested_probes);
+  RUN_TEST(test_inner_counts_for_outer);
+  RUN_TEST(test_loop_sampled_at_end);
+  RUN_TEST(test_heap_counts_allocations);
+  RUN_TEST(test_loop_does_not_leak);
+  RUN_TEST(test_short_heap_shares_canvas);
+  RUN_TEST(test_no_heap_for_canvases);
+  return UNITY_END();
+}
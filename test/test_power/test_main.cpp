@@ -0,0 +1,93 @@
+// Current estimate of the panel against a pixel by pixel sum of the same model and
+// against the figure for a fully white panel worked out by hand.
+
+#include <unity.h>
+#include "../../src/main.cpp"
+
+void fillPanel(uint16_t color)
+{
+  for (int y = 0; y < 32; y++)
+  {
+    for (int x = 0; x < 64; x++)
+    {
+      drawPanelPixel(x, y, color);
+    }
+  }
+}
+
+// every lit LED on for its duty, one at a time
+float bruteForceMa(uint8_t level)
+{
+  float sum = 0;
+  for (int i = 0; i < 64 * 32; i++)
+  {
+    uint16_t c = panelShadow[i];
+    sum += POWER_LED_MA * halPanelDuty(level, refreshIntervalUs) * (c >> 11) / 31.0f;
+    sum += POWER_LED_MA * halPanelDuty(level, refreshIntervalUs) * ((c >> 5) & 0x3F) / 63.0f;
+    sum += POWER_LED_MA * halPanelDuty(level, refreshIntervalUs) * (c & 0x1F) / 31.0f;
+  }
+  return POWER_IDLE_MA + sum;
+}
+
+void setUp()
+{
+  powerBudgetMa = 100000;
+  brightnessLimit = 255;
+  brightness = 255;
+  fillPanel(colBlack);
+}
+
+void tearDown()
+{
+}
+
+void test_black_is_idle()
+{
+  TEST_ASSERT_EQUAL(POWER_IDLE_MA, powerEstimateMa());
+}
+
+// 2048 pixels of three colors at 20 mA, lit 80 us of every 4000 us refresh
+void test_full_white()
+{
+  fillPanel(0xFFFF);
+  TEST_ASSERT_UINT_WITHIN(1, 180 + 20 * 3 * 2048 * 80 / 4000, powerEstimateMa());
+}
+
+void test_matches_brute_force()
+{
+  fillPanel(colBlack);
+  for (int i = 0; i < 64 * 32; i += 3)
+  {
+    drawPanelPixel(i % 64, i / 64, (uint16_t)(i * 2654435761u >> 16));
+  }
+  TEST_ASSERT_TRUE(powerSumsValid());
+  for (int level = 1; level <= 255; level += 127)
+  {
+    brightness = level;
+    TEST_ASSERT_FLOAT_WITHIN(1, bruteForceMa(level), powerEstimateMa());
+  }
+}
+
+void test_limit_keeps_budget()
+{
+  fillPanel(0xFFFF);
+  powerBudgetMa = 2000;
+  updatePowerLimit();
+  TEST_ASSERT_LESS_THAN(255, brightnessLimit);
+  TEST_ASSERT_LESS_OR_EQUAL(2000, powerEstimateMa());
+  TEST_ASSERT_LESS_OR_EQUAL(2000, (uint32_t)bruteForceMa(brightnessLimit));
+}
+
+int main(int argc, char **argv)
+{
+  char root[] = "/tmp/test_powerXXXXXX";
+  LittleFS.setRoot(mkdtemp(root));
+  setup();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_black_is_idle);
+  RUN_TEST(test_full_white);
+  RUN_TEST(test_matches_brute_force);
+  RUN_TEST(test_limit_keeps_budget);
+  return UNITY_END();
+}
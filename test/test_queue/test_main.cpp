@@ -0,0 +1,137 @@
+// Lock-free handoff under threads: one thread posts commands while another drains them,
+// and one publishes the model while another reads it like the refresh ISR. Nothing may
+// get lost, reordered or torn.
+
+#include <unity.h>
+#include "../../src/main.cpp"
+#include <atomic>
+#include <thread>
+
+#define STRESS_COMMANDS 10000000
+#define STRESS_MODELS 1000000
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+// powers are posted in ascending order, a drain never shows an older one or a stale slot
+void test_queue_threads()
+{
+  drainCommands();
+  uint32_t droppedBefore = commandsDropped;
+  std::atomic<bool> producing(true);
+  uint32_t retries = 0;
+  std::thread producer([&]() {
+    for (int i = 0; i < STRESS_COMMANDS; i++)
+    {
+      while (!postCommand(CMD_POWER, i))
+      {
+        retries++;
+        std::this_thread::yield();
+      }
+    }
+    producing = false;
+  });
+
+  float last = -1;
+  bool ordered = true;
+  uint32_t drains = 0;
+  while (producing || commandSpace() < COMMAND_QUEUE_SIZE)
+  {
+    // on a single core the producer only runs when the consumer lets it
+    if (commandSpace() == COMMAND_QUEUE_SIZE)
+    {
+      std::this_thread::yield();
+    }
+    drainCommands();
+    drains++;
+    if (powerNow < last)
+    {
+      ordered = false;
+    }
+    last = powerNow;
+  }
+  producer.join();
+  drainCommands();
+  printf("%u drains, %u retries on a full queue\n", drains, retries);
+
+  TEST_ASSERT_TRUE(ordered);
+  TEST_ASSERT_EQUAL_FLOAT(STRESS_COMMANDS - 1, powerNow);
+  TEST_ASSERT_EQUAL(retries, commandsDropped - droppedBefore);
+  TEST_ASSERT_EQUAL(COMMAND_QUEUE_SIZE, commandSpace());
+}
+
+// every field of a model holds the same counter, a copy mixing two models is torn
+void setModel(int i)
+{
+  tempIn = tempOut = humidityOut = forecastLow = forecastHigh = powerNow = energyToday = i;
+  currentLight = i;
+  heatingMode = i;
+  publishModel();
+}
+
+void test_seqlock_threads()
+{
+  setModel(0);
+  std::atomic<bool> writing(true);
+  std::thread writer([&]() {
+    for (int i = 1; i <= STRESS_MODELS; i++)
+    {
+      setModel(i);
+    }
+    writing = false;
+  });
+
+  uint32_t reads = 0;
+  uint32_t failed = 0;
+  uint32_t torn = 0;
+  float last = 0;
+  bool ordered = true;
+  while (writing)
+  {
+    DisplayModel m;
+    if (!readModel(m))
+    {
+      failed++;
+      continue;
+    }
+    reads++;
+    if (m.tempOut != m.tempIn || m.humidityOut != m.tempIn || m.forecastLow != m.tempIn ||
+        m.forecastHigh != m.tempIn || m.powerNow != m.tempIn || m.energyToday != m.tempIn ||
+        m.light != m.tempIn || m.heatingMode != (int)m.tempIn)
+    {
+      torn++;
+    }
+    if (m.tempIn < last)
+    {
+      ordered = false;
+    }
+    last = m.tempIn;
+  }
+  writer.join();
+  printf("%u reads, %u gave up on a running write\n", reads, failed);
+
+  TEST_ASSERT_EQUAL(0, torn);
+  TEST_ASSERT_TRUE(ordered);
+  TEST_ASSERT_GREATER_THAN(0, reads);
+  DisplayModel m;
+  TEST_ASSERT_TRUE(readModel(m));
+  TEST_ASSERT_EQUAL_FLOAT(STRESS_MODELS, m.tempIn);
+}
+
+int main(int argc, char **argv)
+{
+  char root[] = "/tmp/test_queueXXXXXX";
+  LittleFS.setRoot(mkdtemp(root));
+  setup();
+  display_update_enable(false);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_queue_threads);
+  RUN_TEST(test_seqlock_threads);
+  return UNITY_END();
+}
@@ -0,0 +1,63 @@
+// Refresh timing on the host: the scan model the interval is checked against before the
+// ISR was measured, and the simulated timer1 running the ISR at the set interval.
+
+#include <unity.h>
+#include "../../src/main.cpp"
+
+void setUp()
+{
+  display_update_enable(false);
+  refreshIsrMaxUs = 0;
+  refreshIntervalUs = 4000;
+}
+
+void tearDown()
+{
+}
+
+// 16 row pairs of 80 us on, 20 us shifting and 5 us latching, at most half the CPU
+void test_model()
+{
+  TEST_ASSERT_EQUAL(16 * (80 + 20 + 5), halPanelScanUs());
+  TEST_ASSERT_EQUAL(16 * (80 + 20 + 5) * 2, refreshMinIntervalUs());
+}
+
+void test_default_accepted()
+{
+  TEST_ASSERT_LESS_OR_EQUAL(4000, refreshMinIntervalUs());
+  TEST_ASSERT_TRUE(setRefreshInterval(4000));
+  TEST_ASSERT_EQUAL(4000, refreshIntervalUs);
+}
+
+void test_out_of_range_rejected()
+{
+  TEST_ASSERT_FALSE(setRefreshInterval(refreshMinIntervalUs() - 1));
+  TEST_ASSERT_FALSE(setRefreshInterval(HAL_TIMER_MAX_US + 1));
+  TEST_ASSERT_EQUAL(4000, refreshIntervalUs);
+}
+
+void test_timer_runs_isr()
+{
+  display_update_enable(true);
+  TEST_ASSERT_TRUE(refreshActive);
+  uint32_t calls = refreshCalls;
+  delay(100);
+  display_update_enable(false);
+  // 25 at 4 ms, the host scheduler may lose a few
+  TEST_ASSERT_UINT_WITHIN(10, 25, refreshCalls - calls);
+  TEST_ASSERT_GREATER_THAN(0, refreshCount);
+}
+
+int main(int argc, char **argv)
+{
+  char root[] = "/tmp/test_refreshXXXXXX";
+  LittleFS.setRoot(mkdtemp(root));
+  setup();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_model);
+  RUN_TEST(test_default_accepted);
+  RUN_TEST(test_out_of_range_rejected);
+  RUN_TEST(test_timer_runs_isr);
+  return UNITY_END();
+}
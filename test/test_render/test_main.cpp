@@ -0,0 +1,92 @@
+// Page rendering on the host: pages are drawn into their canvases and reach the panel
+// through the shadow buffer, transitions blend between two finished pages.
+
+#include <unity.h>
+#include "../../src/main.cpp"
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+bool pageBlank(int page)
+{
+  const uint16_t *buf = pageCanvas[page]->getBuffer();
+  for (int i = 0; i < 64 * 32; i++)
+  {
+    if (buf[i] != colBlack)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void test_pages_draw_something()
+{
+  tempIn = 21.5;
+  tempOut = -3;
+  powerNow = 450;
+  for (int i = 0; i < PAGE_COUNT; i++)
+  {
+    renderPage(i);
+    TEST_ASSERT_FALSE_MESSAGE(pageBlank(i), pageNames[i]);
+  }
+}
+
+void test_render_is_repeatable()
+{
+  static uint16_t first[64 * 32];
+  renderPage(PAGE_WEATHER);
+  memcpy(first, pageCanvas[PAGE_WEATHER]->getBuffer(), sizeof(first));
+  renderPage(PAGE_WEATHER);
+  TEST_ASSERT_EQUAL_MEMORY(first, pageCanvas[PAGE_WEATHER]->getBuffer(), sizeof(first));
+}
+
+void test_value_changes_page()
+{
+  static uint16_t before[64 * 32];
+  tempOut = 5;
+  renderPage(PAGE_WEATHER);
+  memcpy(before, pageCanvas[PAGE_WEATHER]->getBuffer(), sizeof(before));
+  tempOut = 17;
+  renderPage(PAGE_WEATHER);
+  TEST_ASSERT_TRUE(memcmp(before, pageCanvas[PAGE_WEATHER]->getBuffer(), sizeof(before)) != 0);
+}
+
+void test_blit_reaches_panel()
+{
+  renderPage(PAGE_ENERGY);
+  blitPage(PAGE_ENERGY);
+  TEST_ASSERT_EQUAL_MEMORY(pageCanvas[PAGE_ENERGY]->getBuffer(), panelShadow, sizeof(panelShadow));
+  TEST_ASSERT_EQUAL_MEMORY(panelShadow, display.pixels, sizeof(panelShadow));
+  TEST_ASSERT_TRUE(powerSumsValid());
+}
+
+void test_transition_ends_on_both_pages()
+{
+  renderPage(PAGE_WEATHER);
+  renderPage(PAGE_ENERGY);
+  drawTransitionFrame(PAGE_WEATHER, PAGE_ENERGY, 0);
+  TEST_ASSERT_EQUAL_MEMORY(pageCanvas[PAGE_WEATHER]->getBuffer(), panelShadow, sizeof(panelShadow));
+  drawTransitionFrame(PAGE_WEATHER, PAGE_ENERGY, TRANSITION_STEPS);
+  TEST_ASSERT_EQUAL_MEMORY(pageCanvas[PAGE_ENERGY]->getBuffer(), panelShadow, sizeof(panelShadow));
+}
+
+int main(int argc, char **argv)
+{
+  char root[] = "/tmp/test_renderXXXXXX";
+  LittleFS.setRoot(mkdtemp(root));
+  setup();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_pages_draw_something);
+  RUN_TEST(test_render_is_repeatable);
+  RUN_TEST(test_value_changes_page);
+  RUN_TEST(test_blit_reaches_panel);
+  RUN_TEST(test_transition_ends_on_both_pages);
+  return UNITY_END();
+}
@@ -0,0 +1,210 @@
+// Replay on the host: a trace changes values and settings while it runs, afterwards the
+// display is back where it was and nothing of the replay was stored.
+
+#include <unity.h>
+#include "../../src/main.cpp"
+
+uint8_t trace[1024];
+int traceLength = 0;
+
+void traceVarint(uint32_t v)
+{
+  while (v >= 0x80)
+  {
+    trace[traceLength++] = v | 0x80;
+    v >>= 7;
+  }
+  trace[traceLength++] = v;
+}
+
+void traceMessage(uint32_t ms, const char *topic, const uint8_t *payload, uint32_t length)
+{
+  trace[traceLength++] = TRACE_MQTT;
+  traceVarint(ms);
+  trace[traceLength++] = strlen(topic);
+  memcpy(trace + traceLength, topic, strlen(topic));
+  traceLength += strlen(topic);
+  traceVarint(length);
+  memcpy(trace + traceLength, payload, length);
+  traceLength += length;
+}
+
+void traceMessage(uint32_t ms, const char *topic, const char *payload)
+{
+  traceMessage(ms, topic, (const uint8_t *)payload, strlen(payload));
+}
+
+void writeTrace()
+{
+  HalFile f = halFsOpen(TRACE_FILE, "w");
+  f.write(trace, traceLength);
+  f.close();
+}
+
+void receive(const char *topic, const char *payload)
+{
+  char t[128];
+  strcpy(t, topic);
+  mqttCallback(t, (byte *)payload, strlen(payload));
+}
+
+// runs the replay task until the given number of records was replayed or it ended
+void replayUntil(unsigned long events)
+{
+  for (int i = 0; i < 1000 && replaying && replayEvents < events; i++)
+  {
+    taskReplay(TASK_DIRECT);
+    delay(1);
+  }
+}
+
+void setUp()
+{
+  traceLength = 0;
+  receive(topTempIn, "20.5");
+  receive(topTempOut, "4");
+  drainCommands();
+  receive(topPage, "energy");
+  receive(topTheme, "night");
+  receive(topPowerBudget, "1500");
+  receive(topDither, "1");
+  receive(topNightSchedule, "22:30-06:00");
+}
+
+void tearDown()
+{
+  if (replaying)
+  {
+    finishReplay();
+  }
+}
+
+void test_values_and_settings_restored()
+{
+  traceMessage(0, topTempIn, "30");
+  traceMessage(0, topTempOut, "-8");
+  traceMessage(0, topPage, "weather");
+  traceMessage(0, topTheme, "day");
+  traceMessage(0, topPowerBudget, "900");
+  traceMessage(0, topDither, "0");
+  traceMessage(0, topNightSchedule, "off");
+  traceMessage(0, topLayout, layoutBuiltin, sizeof(layoutBuiltin));
+  traceMessage(0, topMinimalBright, "40");
+  // keeps the replay running until the state in between was checked, 100 ms at this speed
+  traceMessage(100000, topTempIn, "31");
+  writeTrace();
+
+  startReplay(1000);
+  replayUntil(9);
+  TEST_ASSERT_TRUE(replaying);
+  drainCommands();
+  TEST_ASSERT_EQUAL_FLOAT(30, tempIn);
+  TEST_ASSERT_EQUAL_FLOAT(-8, tempOut);
+  TEST_ASSERT_EQUAL(PAGE_WEATHER, pinnedPage);
+  TEST_ASSERT_EQUAL_PTR(&themeDay, themeTarget);
+  TEST_ASSERT_EQUAL(900, powerBudgetMa);
+  TEST_ASSERT_FALSE(ditherEnabled);
+  TEST_ASSERT_FALSE(nightScheduleOn);
+  TEST_ASSERT_TRUE(layoutActive);
+  TEST_ASSERT_EQUAL(40 * 16, minimalBrightFine);
+
+  replayUntil(10);
+  TEST_ASSERT_FALSE(replaying);
+  TEST_ASSERT_EQUAL_FLOAT(20.5, tempIn);
+  TEST_ASSERT_EQUAL_FLOAT(4, tempOut);
+  TEST_ASSERT_EQUAL(PAGE_ENERGY, pinnedPage);
+  TEST_ASSERT_EQUAL_PTR(&themeNight, themeTarget);
+  TEST_ASSERT_EQUAL(1500, powerBudgetMa);
+  TEST_ASSERT_TRUE(ditherEnabled);
+  TEST_ASSERT_TRUE(nightScheduleOn);
+  TEST_ASSERT_EQUAL(22 * 60 + 30, nightStart);
+  TEST_ASSERT_FALSE(layoutActive);
+  TEST_ASSERT_EQUAL(3 * 16 + 8, minimalBrightFine);
+
+  // the value of the last record was posted but must not arrive after the restore
+  drainCommands();
+  TEST_ASSERT_EQUAL_FLOAT(20.5, tempIn);
+  DisplayModel model;
+  TEST_ASSERT_TRUE(readModel(model));
+  TEST_ASSERT_EQUAL_FLOAT(20.5, model.tempIn);
+}
+
+void test_nothing_stored()
+{
+  halFsRemove(STATE_FILE);
+  halFsRemove(LAYOUT_FILE);
+  stateSavedAt = 0;
+  traceMessage(0, topTempIn, "30");
+  traceMessage(0, topLayout, layoutBuiltin, sizeof(layoutBuiltin));
+  traceMessage(100000, topTempIn, "31");
+  writeTrace();
+
+  startReplay(1000);
+  replayUntil(2);
+  drainCommands();
+  saveState(true);
+  taskState(TASK_DIRECT);
+  TEST_ASSERT_FALSE(LittleFS.exists(STATE_FILE));
+  TEST_ASSERT_FALSE(LittleFS.exists(LAYOUT_FILE));
+
+  replayUntil(3);
+  TEST_ASSERT_FALSE(replaying);
+  TEST_ASSERT_FALSE(LittleFS.exists(LAYOUT_FILE));
+  saveState(true);
+  TEST_ASSERT_TRUE(LittleFS.exists(STATE_FILE));
+  loadState();
+  TEST_ASSERT_EQUAL_FLOAT(20.5, tempIn);
+}
+
+// a layout stored before the replay is active again afterwards
+void test_stored_layout_back()
+{
+  receive(topLayout, "");
+  char t[] = topLayout;
+  mqttCallback(t, (byte *)layoutBuiltin, sizeof(layoutBuiltin));
+  TEST_ASSERT_TRUE(layoutActive);
+  traceMessage(0, topLayout, (const uint8_t *)"", 0);
+  // not in the same batch as the first record
+  traceMessage(100000, topTempIn, "31");
+  writeTrace();
+
+  startReplay(1000);
+  replayUntil(1);
+  TEST_ASSERT_FALSE(layoutActive);
+  TEST_ASSERT_TRUE(LittleFS.exists(LAYOUT_FILE));
+  replayUntil(2);
+  TEST_ASSERT_FALSE(replaying);
+  TEST_ASSERT_TRUE(layoutActive);
+  receive(topLayout, "");
+}
+
+// the replay topic is taken while live messages are ignored
+void test_replay_stopped_live()
+{
+  traceMessage(0, topTempIn, "30");
+  traceMessage(5000, topTempIn, "31");
+  writeTrace();
+
+  startReplay(1);
+  replayUntil(1);
+  TEST_ASSERT_TRUE(replaying);
+  receive(topTempIn, "25");
+  receive(topReplay, "0");
+  TEST_ASSERT_FALSE(replaying);
+  drainCommands();
+  TEST_ASSERT_EQUAL_FLOAT(20.5, tempIn);
+}
+
+int main(int argc, char **argv)
+{
+  char root[] = "/tmp/test_replayXXXXXX";
+  LittleFS.setRoot(mkdtemp(root));
+  setup();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_values_and_settings_restored);
+  RUN_TEST(test_nothing_stored);
+  RUN_TEST(test_stored_layout_back);
+  RUN_TEST(test_replay_stopped_live);
+  return UNITY_END();
+}
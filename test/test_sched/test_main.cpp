@@ -0,0 +1,153 @@
+// Scheduler on a virtual clock: releases stay on the period grid, a late task runs once
+// and every release it overran is counted as skipped, priorities decide between due tasks.
+
+#include <unity.h>
+#include "../../src/main.cpp"
+
+uint64_t virtualUs = 0;
+// how long the next run of a test task takes
+uint64_t runUs = 0;
+char order[16];
+int orderLen = 0;
+
+uint64_t virtualClock()
+{
+  return virtualUs;
+}
+
+void taskA(xTaskId)
+{
+  order[orderLen++] = 'A';
+  virtualUs += runUs;
+}
+
+void taskB(xTaskId)
+{
+  order[orderLen++] = 'B';
+  virtualUs += runUs;
+}
+
+void setUp()
+{
+  schedClock = virtualClock;
+  schedTaskCount = 0;
+  virtualUs = 0;
+  runUs = 0;
+  orderLen = 0;
+}
+
+void tearDown()
+{
+  schedClock = halMicros64;
+}
+
+// runs task 0 once at the given time
+void runAt(uint64_t us, uint64_t takesUs)
+{
+  virtualUs = us;
+  runUs = takesUs;
+  taskSched(0);
+}
+
+void test_not_due_before_release()
+{
+  addTask("a", taskA, 1000, 1, 1000);
+  runAt(999, 10);
+  TEST_ASSERT_EQUAL(0, schedTasks[0].runs);
+  runAt(1000, 10);
+  TEST_ASSERT_EQUAL(1, schedTasks[0].runs);
+  TEST_ASSERT_EQUAL(2000, schedTasks[0].release);
+}
+
+void test_late_within_period()
+{
+  addTask("a", taskA, 1000, 1, 1000);
+  runAt(1500, 100);
+  TEST_ASSERT_EQUAL(2000, schedTasks[0].release);
+  TEST_ASSERT_EQUAL(0, schedTasks[0].skipped);
+  TEST_ASSERT_EQUAL(0, schedTasks[0].deadlineMisses);
+}
+
+// ending on a boundary drops that release, it is not strictly after the end
+void test_end_on_boundary()
+{
+  addTask("a", taskA, 1000, 1, 1000);
+  runAt(1000, 1000);
+  TEST_ASSERT_EQUAL(3000, schedTasks[0].release);
+  TEST_ASSERT_EQUAL(1, schedTasks[0].skipped);
+}
+
+void test_overrun_counts_every_period()
+{
+  addTask("a", taskA, 1000, 1, 1000);
+  runAt(1000, 2500);
+  TEST_ASSERT_EQUAL(4000, schedTasks[0].release);
+  TEST_ASSERT_EQUAL(2, schedTasks[0].skipped);
+  TEST_ASSERT_EQUAL(1, schedTasks[0].deadlineMisses);
+  TEST_ASSERT_EQUAL(1, schedTasks[0].budgetOverruns);
+  // not due again until then
+  runAt(3999, 10);
+  TEST_ASSERT_EQUAL(1, schedTasks[0].runs);
+}
+
+void test_releases_stay_on_grid()
+{
+  addTask("a", taskA, 1000, 1, 1000);
+  uint32_t lateness[] = {0, 300, 999, 1000, 2700, 50, 4100};
+  for (uint32_t late : lateness)
+  {
+    runAt(schedTasks[0].release + late, late % 700);
+    TEST_ASSERT_EQUAL(0, schedTasks[0].release % 1000);
+    TEST_ASSERT_GREATER_THAN(virtualUs, schedTasks[0].release);
+  }
+  // every period up to the last release was either run or skipped
+  TEST_ASSERT_EQUAL(schedTasks[0].release / 1000 - 1, schedTasks[0].runs + schedTasks[0].skipped);
+}
+
+void test_priority_then_release()
+{
+  addTask("a", taskA, 1000, 1, 1000);
+  addTask("b", taskB, 500, 2, 1000);
+  virtualUs = 1000;
+  taskSched(0);
+  taskSched(0);
+  TEST_ASSERT_EQUAL('B', order[0]);
+  TEST_ASSERT_EQUAL('A', order[1]);
+
+  // equal priorities, the earlier release first
+  schedTasks[1].priority = 1;
+  schedTasks[0].release = 1900;
+  schedTasks[1].release = 1800;
+  virtualUs = 2000;
+  taskSched(0);
+  TEST_ASSERT_EQUAL('B', order[2]);
+}
+
+void test_resumed_task_due()
+{
+  addTask("a", taskA, 1000, 1, 1000);
+  suspendTask(0, true);
+  runAt(5000, 10);
+  TEST_ASSERT_EQUAL(0, schedTasks[0].runs);
+  suspendTask(0, false);
+  runAt(5000, 10);
+  TEST_ASSERT_EQUAL(1, schedTasks[0].runs);
+  TEST_ASSERT_EQUAL(6000, schedTasks[0].release);
+}
+
+int main(int argc, char **argv)
+{
+  char root[] = "/tmp/test_schedXXXXXX";
+  LittleFS.setRoot(mkdtemp(root));
+  setup();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_not_due_before_release);
+  RUN_TEST(test_late_within_period);
+  RUN_TEST(test_end_on_boundary);
+  RUN_TEST(test_overrun_counts_every_period);
+  RUN_TEST(test_releases_stay_on_grid);
+  RUN_TEST(test_priority_then_release);
+  RUN_TEST(test_resumed_task_due);
+  return UNITY_END();
+}
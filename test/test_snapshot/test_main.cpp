@@ -0,0 +1,240 @@
+// Snapshots on the host: the QOI image is the frame on the panel, colon and transition
+// included, it decodes back to panelShadow and matches a stored golden image. The same
+// bytes come out of GET /snapshot.
+//
+// A missing golden.qoi is written from the current frame and the test fails once, look
+// at the image before committing it.
+
+#include <unity.h>
+#include "../../src/main.cpp"
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <vector>
+
+#define GOLDEN_FILE "test/test_snapshot/golden.qoi"
+
+class ByteBuffer : public Print
+{
+public:
+  std::vector<uint8_t> bytes;
+  size_t write(uint8_t b) override
+  {
+    bytes.push_back(b);
+    return 1;
+  }
+  size_t write(const uint8_t *buffer, size_t size) override
+  {
+    bytes.insert(bytes.end(), buffer, buffer + size);
+    return size;
+  }
+};
+
+// RGB888 like the encoder widens it
+uint32_t widen(uint16_t color)
+{
+  uint8_t r = (color >> 11) & 0x1F;
+  uint8_t g = (color >> 5) & 0x3F;
+  uint8_t b = color & 0x1F;
+  return (uint32_t)((r << 3) | (r >> 2)) << 16 | ((g << 2) | (g >> 4)) << 8 | ((b << 3) | (b >> 2));
+}
+
+// a plain QOI decoder for 64x32 RGB images, false on anything unexpected
+bool decodeQoi(const std::vector<uint8_t> &in, uint32_t *out)
+{
+  if (in.size() < 22 || memcmp(in.data(), "qoif", 4) != 0 || in[7] != 64 || in[11] != 32)
+  {
+    return false;
+  }
+  uint32_t index[64] = {0};
+  uint8_t r = 0, g = 0, b = 0;
+  size_t p = 14;
+  int n = 0;
+  while (n < 64 * 32 && p < in.size() - 8)
+  {
+    uint8_t op = in[p++];
+    int run = 1;
+    if (op == 0xFE)
+    {
+      r = in[p++];
+      g = in[p++];
+      b = in[p++];
+    }
+    else if ((op & 0xC0) == 0x00)
+    {
+      uint32_t px = index[op];
+      r = px >> 16;
+      g = px >> 8;
+      b = px;
+    }
+    else if ((op & 0xC0) == 0x40)
+    {
+      r += ((op >> 4) & 3) - 2;
+      g += ((op >> 2) & 3) - 2;
+      b += (op & 3) - 2;
+    }
+    else if ((op & 0xC0) == 0x80)
+    {
+      int dg = (op & 0x3F) - 32;
+      uint8_t next = in[p++];
+      r += dg + (next >> 4) - 8;
+      g += dg;
+      b += dg + (next & 15) - 8;
+    }
+    else
+    {
+      run = (op & 0x3F) + 1;
+    }
+    uint32_t px = (uint32_t)r << 16 | g << 8 | b;
+    index[(r * 3 + g * 5 + b * 7 + 255 * 11) % 64] = px;
+    for (int i = 0; i < run && n < 64 * 32; i++)
+    {
+      out[n++] = px;
+    }
+  }
+  static const uint8_t padding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+  return n == 64 * 32 && p == in.size() - 8 && memcmp(in.data() + p, padding, 8) == 0;
+}
+
+void assertShowsPanel(const std::vector<uint8_t> &image)
+{
+  static uint32_t decoded[64 * 32];
+  TEST_ASSERT_TRUE(decodeQoi(image, decoded));
+  for (int i = 0; i < 64 * 32; i++)
+  {
+    TEST_ASSERT_EQUAL_HEX32(widen(panelShadow[i]), decoded[i]);
+  }
+}
+
+// the clock page on the panel with a fixed time, values, theme and a fully lit colon
+void drawFixedFrame()
+{
+  themeAuto = false;
+  theme = &themeDay;
+  themeTarget = &themeDay;
+  themeFadeStep = -1;
+  rollDigits = false;
+  rollFrame = -1;
+  lightMeterDebug = false;
+  showSparkline = false;
+  activateLayout(false);
+  currentHour = 12;
+  currentMinute = 34;
+  tempIn = 21.5;
+  tempOut = -3.5;
+  humidityOut = 80;
+  heatingMode = 1;
+  powerNow = 450;
+  energyToday = 7.25;
+  clockColon = 32;
+  renderPage(PAGE_CLOCK);
+  renderPage(PAGE_WEATHER);
+  blitPage(PAGE_CLOCK);
+}
+
+void setUp()
+{
+  display_update_enable(false);
+  drawFixedFrame();
+}
+
+void tearDown()
+{
+}
+
+void test_colon_included()
+{
+  // the colon is drawn on the panel only, the page canvas does not have it
+  TEST_ASSERT_TRUE(memcmp(panelShadow, pageCanvas[PAGE_CLOCK]->getBuffer(), sizeof(panelShadow)) != 0);
+  ByteBuffer image;
+  writeSnapshot(image);
+  TEST_ASSERT_EQUAL(snapshotLength(), image.bytes.size());
+  assertShowsPanel(image.bytes);
+}
+
+void test_transition_included()
+{
+  transitionType = TRANSITION_SLIDE;
+  drawTransitionFrame(PAGE_CLOCK, PAGE_WEATHER, TRANSITION_STEPS / 2);
+  ByteBuffer image;
+  writeSnapshot(image);
+  assertShowsPanel(image.bytes);
+}
+
+void test_matches_golden()
+{
+  transitionType = TRANSITION_SLIDE;
+  drawTransitionFrame(PAGE_CLOCK, PAGE_WEATHER, TRANSITION_STEPS / 4);
+  ByteBuffer image;
+  writeSnapshot(image);
+
+  FILE *f = fopen(GOLDEN_FILE, "rb");
+  if (f == NULL)
+  {
+    f = fopen(GOLDEN_FILE, "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    fwrite(image.bytes.data(), 1, image.bytes.size(), f);
+    fclose(f);
+    TEST_FAIL_MESSAGE("no golden image, wrote " GOLDEN_FILE);
+  }
+  std::vector<uint8_t> golden(4096);
+  golden.resize(fread(golden.data(), 1, golden.size(), f));
+  fclose(f);
+  TEST_ASSERT_EQUAL(golden.size(), image.bytes.size());
+  TEST_ASSERT_EQUAL_MEMORY(golden.data(), image.bytes.data(), golden.size());
+}
+
+// GET /snapshot sends the same image as the MQTT snapshot
+void test_http_snapshot()
+{
+  ByteBuffer image;
+  writeSnapshot(image);
+
+  int s = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(HTTP_PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  TEST_ASSERT_EQUAL(0, connect(s, (struct sockaddr *)&addr, sizeof(addr)));
+  const char request[] = "GET /snapshot HTTP/1.1\r\nHost: display\r\n\r\n";
+  send(s, request, sizeof(request) - 1, 0);
+
+  std::vector<uint8_t> response;
+  struct timeval timeout = {0, 1000};
+  setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  for (int i = 0; i < 2000; i++)
+  {
+    serveHttp();
+    uint8_t buffer[1024];
+    ssize_t n = recv(s, buffer, sizeof(buffer), 0);
+    if (n == 0)
+    {
+      break;
+    }
+    if (n > 0)
+    {
+      response.insert(response.end(), buffer, buffer + n);
+    }
+  }
+  close(s);
+
+  const char *end = "\r\n\r\n";
+  auto body = std::search(response.begin(), response.end(), end, end + 4);
+  TEST_ASSERT_TRUE(body != response.end());
+  std::vector<uint8_t> received(body + 4, response.end());
+  TEST_ASSERT_EQUAL(image.bytes.size(), received.size());
+  TEST_ASSERT_EQUAL_MEMORY(image.bytes.data(), received.data(), received.size());
+}
+
+int main(int argc, char **argv)
+{
+  char root[] = "/tmp/test_snapshotXXXXXX";
+  LittleFS.setRoot(mkdtemp(root));
+  setup();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_colon_included);
+  RUN_TEST(test_transition_included);
+  RUN_TEST(test_matches_golden);
+  RUN_TEST(test_http_snapshot);
+  return UNITY_END();
+}
@@ -0,0 +1,209 @@
+// Beacon sync with several displays on loopback: each node is a forked process with
+// its own monotonic clock and a wall clock that is off by seconds. They agree on the
+// lowest id as leader, share its time and colon phase within a millisecond, and move
+// to the next lowest id once the leader is gone.
+
+#include <unity.h>
+#include "../../src/main.cpp"
+#include <signal.h>
+#include <sys/wait.h>
+
+#define NODES 3
+// no beacon of the leader for BEACON_TIMEOUT_MS, then one more interval to take over
+#define CONVERGED_S 6
+#define LEADER_KILLED_S 7
+#define FAILED_OVER_S 20
+#define ALIGN_US 1000
+
+struct Report
+{
+  uint32_t id;
+  uint32_t leader;
+  bool valid;
+  // reference time minus the host's monotonic clock at the same moment
+  int64_t referenceUs;
+  // reference time at which the colon last started to brighten, modulo two periods
+  int64_t colonUs;
+};
+
+uint64_t startUs;
+int64_t nodeSkewUs;
+
+uint64_t hostMonotonicUs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t skewedClock()
+{
+  return halMicros64() + nodeSkewUs;
+}
+
+Report report()
+{
+  Report r;
+  r.id = syncId;
+  r.leader = syncLeader;
+  r.valid = syncValid;
+  r.referenceUs = (int64_t)syncNowUs() - (int64_t)hostMonotonicUs();
+  Tween *colon = tweenFind(colonTween);
+  int64_t start = colon != NULL ? (int64_t)colon->start + syncOffsetUs + (colon->reverse ? COLON_PERIOD_US : 0) : -1;
+  r.colonUs = ((start % (2 * COLON_PERIOD_US)) + 2 * COLON_PERIOD_US) % (2 * COLON_PERIOD_US);
+  return r;
+}
+
+void runUntil(uint64_t untilUs)
+{
+  while (hostMonotonicUs() < untilUs)
+  {
+    loop();
+    usleep(200);
+  }
+}
+
+// a display of its own, reports once converged and once more after the failover
+void node(int index, int out)
+{
+  nodeSkewUs = (index + 1) * 123456789LL;
+  schedClock = skewedClock;
+  halWallOffsetUs = (index - 1) * 1300000LL;
+  for (int i = 0; i < schedTaskCount; i++)
+  {
+    if (strcmp(schedTasks[i].name, "TASKTIMESYNC") == 0)
+    {
+      suspendTask(i, true);
+    }
+  }
+  syncId = 0;
+  syncLeader = 0;
+  beaconIp = 0;
+  syncValid = false;
+
+  runUntil(startUs + CONVERGED_S * 1000000ULL);
+  Report r = report();
+  write(out, &r, sizeof(r));
+  runUntil(startUs + FAILED_OVER_S * 1000000ULL);
+  r = report();
+  write(out, &r, sizeof(r));
+  _exit(0);
+}
+
+int64_t circular(int64_t a, int64_t b, int64_t period)
+{
+  int64_t d = llabs(a - b) % period;
+  return std::min(d, period - d);
+}
+
+void assertAligned(const Report *reports, const bool *alive, uint32_t leader)
+{
+  const Report *lead = NULL;
+  for (int i = 0; i < NODES; i++)
+  {
+    if (alive[i] && reports[i].id == leader)
+    {
+      lead = &reports[i];
+    }
+  }
+  TEST_ASSERT_NOT_NULL(lead);
+  for (int i = 0; i < NODES; i++)
+  {
+    if (!alive[i])
+    {
+      continue;
+    }
+    printf("node %08x leader %08x reference %+lld us colon %+lld us\n", reports[i].id, reports[i].leader,
+           (long long)(reports[i].referenceUs - lead->referenceUs), (long long)(reports[i].colonUs - lead->colonUs));
+    TEST_ASSERT_TRUE(reports[i].valid);
+    TEST_ASSERT_EQUAL(leader, reports[i].leader);
+    TEST_ASSERT_LESS_THAN(ALIGN_US, llabs(reports[i].referenceUs - lead->referenceUs));
+    TEST_ASSERT_LESS_THAN(ALIGN_US, circular(reports[i].colonUs, lead->colonUs, 2 * COLON_PERIOD_US));
+  }
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_nodes_converge_and_fail_over()
+{
+  startUs = hostMonotonicUs();
+  pid_t pids[NODES];
+  int pipes[NODES];
+  for (int i = 0; i < NODES; i++)
+  {
+    int fds[2];
+    TEST_ASSERT_EQUAL(0, pipe(fds));
+    pids[i] = fork();
+    if (pids[i] == 0)
+    {
+      close(fds[0]);
+      node(i, fds[1]);
+    }
+    close(fds[1]);
+    pipes[i] = fds[0];
+  }
+
+  Report reports[NODES];
+  bool alive[NODES];
+  for (int i = 0; i < NODES; i++)
+  {
+    TEST_ASSERT_EQUAL(sizeof(Report), read(pipes[i], &reports[i], sizeof(Report)));
+    alive[i] = true;
+  }
+  // the id is the process id, see halWifiMac()
+  int first = 0;
+  for (int i = 1; i < NODES; i++)
+  {
+    if (reports[i].id < reports[first].id)
+    {
+      first = i;
+    }
+  }
+  assertAligned(reports, alive, reports[first].id);
+
+  while (hostMonotonicUs() < startUs + LEADER_KILLED_S * 1000000ULL)
+  {
+    usleep(10000);
+  }
+  kill(pids[first], SIGKILL);
+  waitpid(pids[first], NULL, 0);
+  alive[first] = false;
+  int second = -1;
+  for (int i = 0; i < NODES; i++)
+  {
+    if (i != first && (second < 0 || reports[i].id < reports[second].id))
+    {
+      second = i;
+    }
+  }
+
+  for (int i = 0; i < NODES; i++)
+  {
+    if (alive[i])
+    {
+      TEST_ASSERT_EQUAL(sizeof(Report), read(pipes[i], &reports[i], sizeof(Report)));
+      waitpid(pids[i], NULL, 0);
+    }
+    close(pipes[i]);
+  }
+  assertAligned(reports, alive, reports[second].id);
+}
+
+int main(int argc, char **argv)
+{
+  char root[] = "/tmp/test_syncXXXXXX";
+  LittleFS.setRoot(mkdtemp(root));
+  setup();
+  // only the calling thread survives a fork
+  display_update_enable(false);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_nodes_converge_and_fail_over);
+  return UNITY_END();
+}
@@ -0,0 +1,194 @@
+// Tweens on a virtual clock: values follow the elapsed time whatever the frame rate,
+// loops and ping-pong keep their phase across late frames, and the colon, brightness
+// ramp and theme fade all run on the engine.
+
+#include <unity.h>
+#include "../../src/main.cpp"
+
+uint64_t virtualUs = 0;
+int32_t applied = 0;
+
+uint64_t virtualClock()
+{
+  return virtualUs;
+}
+
+void record(int32_t value)
+{
+  applied = value;
+}
+
+void at(uint64_t us)
+{
+  virtualUs = us;
+  updateTweens(virtualUs);
+}
+
+void setUp()
+{
+  schedClock = virtualClock;
+  for (Tween &t : tweens)
+  {
+    t.active = false;
+  }
+  at(1000000);
+  applied = 0;
+}
+
+void tearDown()
+{
+  schedClock = halMicros64;
+}
+
+void test_easing_ends_and_rises()
+{
+  for (int curve = 0; curve < EASE_COUNT; curve++)
+  {
+    TEST_ASSERT_EQUAL(0, ease(curve, 0));
+    TEST_ASSERT_EQUAL(256, ease(curve, 256));
+    for (int p = 1; p <= 256; p++)
+    {
+      TEST_ASSERT_GREATER_OR_EQUAL(ease(curve, p - 1), ease(curve, p));
+    }
+  }
+  TEST_ASSERT_EQUAL(128, ease(EASE_IN_OUT, 128));
+}
+
+void test_value_follows_time()
+{
+  int handle = tweenStart(0, 1000, 1000000, EASE_LINEAR, 0, record);
+  at(1250000);
+  TEST_ASSERT_EQUAL(250, applied);
+  // progress has a resolution of 1/256
+  at(1999999);
+  TEST_ASSERT_INT_WITHIN(1000 / 256, 999, applied);
+  at(2000000);
+  TEST_ASSERT_EQUAL(1000, applied);
+  TEST_ASSERT_NULL(tweenFind(handle));
+}
+
+// updated every millisecond or once, the value at a time is the same
+void test_frame_rate_independent()
+{
+  int fine = tweenStart(0, 4096, 700000, EASE_OUT, 0, NULL);
+  int32_t values[8];
+  for (uint64_t us = 1000000; us <= 1700000; us += 1000)
+  {
+    at(us);
+    if (us % 100000 == 0)
+    {
+      values[(us - 1000000) / 100000] = tweenFind(fine) != NULL ? tweenFind(fine)->value : 4096;
+    }
+  }
+  for (int i = 0; i < 8; i++)
+  {
+    for (Tween &t : tweens)
+    {
+      t.active = false;
+    }
+    at(1000000);
+    int coarse = tweenStart(0, 4096, 700000, EASE_OUT, 0, record);
+    at(1000000 + i * 100000);
+    int32_t value = tweenFind(coarse) != NULL ? tweenFind(coarse)->value : applied;
+    TEST_ASSERT_EQUAL(values[i], value);
+  }
+}
+
+// a looping tween picks up its phase after a long gap instead of slowing down
+void test_colon_keeps_phase()
+{
+  startColonTween();
+  TEST_ASSERT_EQUAL(0, clockColon);
+  at(1000000 + COLON_PERIOD_US / 2);
+  TEST_ASSERT_EQUAL(16, clockColon);
+  at(1000000 + COLON_PERIOD_US);
+  TEST_ASSERT_EQUAL(32, clockColon);
+  at(1000000 + COLON_PERIOD_US * 3 / 2);
+  TEST_ASSERT_EQUAL(16, clockColon);
+  // at six and a quarter periods without a frame since the one and a half
+  at(1000000 + COLON_PERIOD_US * 25 / 4);
+  int32_t late = clockColon;
+  tweenStop(colonTween);
+  at(1000000);
+  startColonTween();
+  for (uint64_t us = 1000000; us <= 1000000 + COLON_PERIOD_US * 25 / 4; us += 20000)
+  {
+    at(us);
+  }
+  at(1000000 + COLON_PERIOD_US * 25 / 4);
+  TEST_ASSERT_EQUAL(late, clockColon);
+  // an even number of periods, running forward again
+  TEST_ASSERT_EQUAL(32 * ease(EASE_IN_OUT, 64) / 256, clockColon);
+}
+
+void test_brightness_ramp()
+{
+  applyBrightnessFine(10 << 4);
+  rampBrightness(100 << 4);
+  int last = brightnessFine;
+  for (uint64_t us = 1000000; us <= 1000000 + BRIGHTNESS_RAMP_US; us += 50000)
+  {
+    at(us);
+    TEST_ASSERT_GREATER_OR_EQUAL(last, brightnessFine);
+    last = brightnessFine;
+  }
+  TEST_ASSERT_EQUAL(100, brightness);
+  TEST_ASSERT_NULL(tweenFind(brightnessTween));
+}
+
+// the theme steps with the time, frames run by the page task
+void test_theme_fade_by_time()
+{
+  themeAuto = false;
+  theme = themeTarget = &themeNight;
+  themeFadeStep = -1;
+  setTheme(&themeDay);
+  TEST_ASSERT_EQUAL_PTR(&themeFade[0], theme);
+  virtualUs = 1000000 + THEME_FADE_MS * 1000UL / 2;
+  taskPages(TASK_DIRECT);
+  TEST_ASSERT_EQUAL_PTR(&themeFade[THEME_FADE_STEPS / 2], theme);
+  virtualUs = 1000000 + THEME_FADE_MS * 1000UL;
+  taskPages(TASK_DIRECT);
+  TEST_ASSERT_EQUAL_PTR(&themeDay, theme);
+  TEST_ASSERT_EQUAL(-1, themeFadeStep);
+  TEST_ASSERT_NULL(tweenFind(themeTween));
+}
+
+void test_full_pool_jumps_to_end()
+{
+  for (int i = 0; i < TWEEN_POOL; i++)
+  {
+    TEST_ASSERT_NOT_EQUAL(TWEEN_NONE, tweenStart(0, 10, 1000000, EASE_LINEAR, 0, NULL));
+  }
+  TEST_ASSERT_EQUAL(TWEEN_NONE, tweenStart(0, 77, 1000000, EASE_LINEAR, 0, record));
+  TEST_ASSERT_EQUAL(77, applied);
+}
+
+void test_stale_handle()
+{
+  int first = tweenStart(0, 10, 1000000, EASE_LINEAR, 0, NULL);
+  tweenStop(first);
+  int second = tweenStart(0, 10, 1000000, EASE_LINEAR, 0, NULL);
+  TEST_ASSERT_EQUAL(first % TWEEN_POOL, second % TWEEN_POOL);
+  TEST_ASSERT_NULL(tweenFind(first));
+  TEST_ASSERT_NOT_NULL(tweenFind(second));
+}
+
+int main(int argc, char **argv)
+{
+  char root[] = "/tmp/test_tweenXXXXXX";
+  LittleFS.setRoot(mkdtemp(root));
+  setup();
+  display_update_enable(false);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_easing_ends_and_rises);
+  RUN_TEST(test_value_follows_time);
+  RUN_TEST(test_frame_rate_independent);
+  RUN_TEST(test_colon_keeps_phase);
+  RUN_TEST(test_brightness_ramp);
+  RUN_TEST(test_theme_fade_by_time);
+  RUN_TEST(test_full_pool_jumps_to_end);
+  RUN_TEST(test_stale_handle);
+  return UNITY_END();
+}
@@ -0,0 +1,80 @@
+"""PlatformIO extra script: moves the code the refresh ISR runs into IRAM.
+
+The timer1 ISR of the ESP8266 build calls PxMATRIX::display() and through it the SPI
+writes. Both are compiled into flash, and an interrupt that lands in flash code while
+the flash cache is off (file system writes, OTA) crashes the chip. ICACHE_RAM_ATTR
+cannot be put on library code, so before linking the sections of these functions are
+renamed to .iram.text.*, which the core's linker script places in IRAM. After linking
+every one of them has to be below the flash mapping, otherwise the build fails.
+
+    [env:nodemcuv2]
+    extra_scripts = post:tools/iram_scan.py
+"""
+
+import os
+import re
+import subprocess
+
+Import("env")  # noqa: F821  provided by PlatformIO
+
+# functions the scan reaches, by mangled name prefix
+SCAN_FUNCTIONS = re.compile(r"^_ZN(8PxMATRIX(7display|5latch|7set_mux|13setBrightness)|8SPIClass(10writeBytes|11writeBytes_|5write|8transfer))")
+SECTION = re.compile(r"^\.(text|literal)\.(\S+)$")
+# start of the memory mapped flash, IRAM is below
+FLASH_START = 0x40200000
+
+
+def tool(name):
+    return env.subst("$OBJCOPY").replace("objcopy", name)  # noqa: F821
+
+
+def scan_sections(path):
+    out = subprocess.run([tool("objdump"), "-h", path], capture_output=True, text=True, check=True).stdout
+    sections = set()
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[0].isdigit():
+            match = SECTION.match(fields[1])
+            if match and SCAN_FUNCTIONS.match(match.group(2)):
+                sections.add(fields[1])
+    return sections
+
+
+def move_to_iram(target, source, env):
+    moved = 0
+    # the framework and library archives are not sources of the program node
+    libraries = [node for node in env.Flatten(env.get("LIBS", [])) if hasattr(node, "get_abspath")]
+    for node in list(source) + libraries:
+        path = node.get_abspath()
+        if not path.endswith((".o", ".a")) or not os.path.exists(path):
+            continue
+        sections = scan_sections(path)
+        if not sections:
+            continue
+        args = [tool("objcopy")]
+        for name in sorted(sections):
+            args += ["--rename-section", "%s=.iram%s" % (name, name)]
+        subprocess.run(args + [path], check=True)
+        moved += len(sections)
+    if moved == 0:
+        print("iram_scan: none of the refresh functions found, is PxMatrix still used?")
+        return 1
+    print("iram_scan: %d sections of the refresh path moved to IRAM" % moved)
+    return 0
+
+
+def check_iram(target, source, env):
+    out = subprocess.run([tool("nm"), target[0].get_abspath()], capture_output=True, text=True, check=True).stdout
+    in_flash = []
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[1] in "tT" and SCAN_FUNCTIONS.match(fields[2]) and int(fields[0], 16) >= FLASH_START:
+            in_flash.append(fields[2])
+    if in_flash:
+        print("iram_scan: still in flash: " + ", ".join(in_flash))
+        return 1
+    return 0
+
+
+env.AddPreAction("$BUILD_DIR/${PROGNAME}.elf", move_to_iram)  # noqa: F821
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", check_iram)  # noqa: F821
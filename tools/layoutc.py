@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""Compiles a text layout into the bytecode read by layoutDecode() in src/main.cpp.
+
+One widget per line, '#' starts a comment:
+
+    label  <font> <color> <x> <y> "<text>"
+    text   <var> <font> <color> <x> <y> [decimals=N] [pad2] [suffix="$C"] [below=<value>:<color>] [above=<value>:<color>]
+    icon   heating <var> <color> <x> <y>
+    colon  <x> <y>
+
+Usage: layoutc.py face.txt face.bin
+       mosquitto_pub -t home/sz/display/layout -f face.bin
+"""
+
+import shlex
+import struct
+import sys
+
+VERSION = 1
+MAX_BYTES = 200
+MAX_LABEL = 12
+
+OP_LABEL, OP_TEXT, OP_THRESHOLD, OP_ICON, OP_COLON = 1, 2, 3, 4, 5
+FONTS = {"freesans12": 0, "lato9": 1, "tomthumb": 2}
+COLORS = {"clock": 0, "text": 1, "warm": 2, "cold": 3, "debug": 4}
+VARS = {"hour": 0, "minute": 1, "tempin": 2, "tempout": 3, "humidity": 4, "forecastlow": 5,
+        "forecasthigh": 6, "power": 7, "energy": 8, "light": 9, "heating": 10}
+ICONS = {"heating": 0}
+PAD2 = 0x04
+
+
+def lookup(table, name, what):
+    if name not in table:
+        raise ValueError("unknown %s '%s', expected one of %s" % (what, name, ", ".join(table)))
+    return table[name]
+
+
+def position(x, y):
+    x, y = int(x), int(y)
+    if not 0 <= x < 64 or not 0 <= y <= 32:
+        raise ValueError("position %d,%d is outside of the panel" % (x, y))
+    return [x, y]
+
+
+def threshold(spec):
+    value, color = spec.split(":")
+    return struct.pack("<h", round(float(value) * 10)) + bytes([lookup(COLORS, color, "color")])
+
+
+def compile_line(words):
+    kind, args = words[0], words[1:]
+    if kind == "label":
+        font, color, x, y, text = args
+        if len(text) > MAX_LABEL:
+            raise ValueError("label longer than %d chars" % MAX_LABEL)
+        return bytes([OP_LABEL, lookup(FONTS, font, "font"), lookup(COLORS, color, "color")] +
+                     position(x, y) + [len(text)]) + text.encode("ascii")
+    if kind == "text":
+        var, font, color, x, y = args[:5]
+        options = dict(o.split("=", 1) if "=" in o else (o, "") for o in args[5:])
+        fmt = int(options.get("decimals", 0)) & 0x03
+        if "pad2" in options:
+            fmt |= PAD2
+        suffix = options.get("suffix", "").encode("ascii")
+        if len(suffix) > 4:
+            raise ValueError("suffix longer than 4 chars")
+        code = bytes([OP_TEXT, lookup(VARS, var, "variable"), lookup(FONTS, font, "font"),
+                      lookup(COLORS, color, "color")] + position(x, y) + [fmt, len(suffix)]) + suffix
+        if "below" in options or "above" in options:
+            code += bytes([OP_THRESHOLD]) + threshold(options.get("below", "-3276:text")) + \
+                threshold(options.get("above", "3276:text"))
+        return code
+    if kind == "icon":
+        icon, var, color, x, y = args
+        return bytes([OP_ICON, lookup(ICONS, icon, "icon"), lookup(VARS, var, "variable"),
+                      lookup(COLORS, color, "color")] + position(x, y))
+    if kind == "colon":
+        return bytes([OP_COLON] + position(*args))
+    raise ValueError("unknown widget '%s'" % kind)
+
+
+def compile_layout(source):
+    code = b"LY" + bytes([VERSION])
+    for number, line in enumerate(source.splitlines(), 1):
+        words = shlex.split(line, comments=True)
+        if not words:
+            continue
+        try:
+            code += compile_line(words)
+        except ValueError as error:
+            raise SystemExit("line %d: %s" % (number, error))
+    if len(code) > MAX_BYTES:
+        raise SystemExit("layout is %d bytes, at most %d fit into one message" % (len(code), MAX_BYTES))
+    return code
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        raise SystemExit(__doc__)
+    with open(sys.argv[1]) as f:
+        code = compile_layout(f.read())
+    with open(sys.argv[2], "wb") as f:
+        f.write(code)
+    print("%d bytes" % len(code))
@@ -0,0 +1,110 @@
+// Replays a trace captured on topCapture on the host and writes every frame that differs
+// from the one before as a PPM image, so a recorded evening can be looked at without the
+// panel. The trace time of each frame in milliseconds goes to stdout.
+//
+//   pio run -e replay
+//   .pio/build/replay/program --trace trace.bin --speed 20 --frames frames
+//
+// The trace is copied into the file system of the program (--fs, ./littlefs by default)
+// and replayed like on the display, live MQTT messages are ignored meanwhile.
+
+#include "../../src/main.cpp"
+#include <sys/stat.h>
+#include <vector>
+
+bool copyTrace(const char *path)
+{
+  FILE *in = fopen(path, "rb");
+  if (in == NULL)
+  {
+    return false;
+  }
+  std::vector<uint8_t> trace;
+  uint8_t buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+  {
+    trace.insert(trace.end(), buffer, buffer + n);
+  }
+  fclose(in);
+
+  HalFile f = halFsOpen(TRACE_FILE, "w");
+  if (!f)
+  {
+    return false;
+  }
+  bool written = f.write(trace.data(), trace.size()) == trace.size();
+  f.close();
+  return written;
+}
+
+// RGB565 widened to 8 bits per channel
+bool writeFrame(const char *path, const uint16_t *pixels)
+{
+  FILE *out = fopen(path, "wb");
+  if (out == NULL)
+  {
+    return false;
+  }
+  fprintf(out, "P6\n64 32\n255\n");
+  for (int i = 0; i < 64 * 32; i++)
+  {
+    uint16_t c = pixels[i];
+    uint8_t rgb[3] = {(uint8_t)((c >> 11) * 255 / 31), (uint8_t)(((c >> 5) & 0x3F) * 255 / 63), (uint8_t)((c & 0x1F) * 255 / 31)};
+    fwrite(rgb, 1, 3, out);
+  }
+  return fclose(out) == 0;
+}
+
+int main(int argc, char **argv)
+{
+  hostArgc = argc;
+  hostArgv = argv;
+  const char *tracePath = hostArg("--trace");
+  const char *speedArg = hostArg("--speed");
+  const char *frameDir = hostArg("--frames");
+  float speed = speedArg != NULL ? atof(speedArg) : 1;
+  if (tracePath == NULL || speed <= 0)
+  {
+    fprintf(stderr, "usage: %s --trace <file> [--speed <factor>] [--frames <dir>] [--fs <dir>]\n", argv[0]);
+    return 2;
+  }
+  if (frameDir == NULL)
+  {
+    frameDir = "frames";
+  }
+  mkdir(frameDir, 0755);
+
+  setup();
+  if (!copyTrace(tracePath))
+  {
+    fprintf(stderr, "cannot read %s\n", tracePath);
+    return 1;
+  }
+  startReplay(speed);
+
+  uint16_t shown[64 * 32];
+  memset(shown, 0, sizeof(shown));
+  int frames = 0;
+  while (replaying)
+  {
+    loop();
+    delayMicroseconds(100);
+    if (memcmp(shown, panelShadow, sizeof(shown)) == 0)
+    {
+      continue;
+    }
+    memcpy(shown, panelShadow, sizeof(shown));
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%06d.ppm", frameDir, frames);
+    if (!writeFrame(path, shown))
+    {
+      fprintf(stderr, "cannot write %s\n", path);
+      return 1;
+    }
+    printf("%06d %lu\n", frames, (unsigned long)((millis() - replayStartMs) * replaySpeed));
+    frames++;
+  }
+  fprintf(stderr, "%lu events, %d frames\n", replayEvents, frames);
+  return 0;
+}